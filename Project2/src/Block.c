@@ -0,0 +1,237 @@
+#include <stdint.h> /* uint32_t */
+#include <stdio.h>	/* fprintf() */
+#include <stdlib.h> /* malloc(), free() */
+#include <string.h> /* memcpy() */
+
+#include "RegFile.h"
+#include "Execute.h"
+#include "MemReport.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Predecode.h"
+#include "Block.h"
+#include "utils/guest_memory.h"
+
+bool BLOCK_PEEPHOLE = true;
+
+static block *BLOCKS = NULL;
+static block *STALE_BLOCKS = NULL;
+static codeWriteHook NEXT_HOOK = NULL;
+static uint32_t NEXT_LINK = 0;
+
+// Ops that end a block: everything that may leave the straight line
+static bool endsBlock(uint8_t op)
+{
+	switch (op)
+	{
+	case OP_Jr:
+	case OP_Jalr:
+	case OP_Syscall:
+	case OP_Break:
+	case OP_Bltz:
+	case OP_Bgez:
+	case OP_Bltzal:
+	case OP_Bgezal:
+	case OP_Beq:
+	case OP_Bne:
+	case OP_Blez:
+	case OP_Bgtz:
+	case OP_J:
+	case OP_Jal:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Stale blocks stay allocated until the next flush because a running
+// block or another block's links may still point at them
+static void codeWritten(uint32_t ADDR)
+{
+	block *b, *tmp;
+	HASH_ITER(hh, BLOCKS, b, tmp)
+	{
+		if (PAGE_NUMBER(b->pc) == PAGE_NUMBER(ADDR))
+		{
+			HASH_DEL(BLOCKS, b);
+			b->stale = true;
+			b->nextStale = STALE_BLOCKS;
+			STALE_BLOCKS = b;
+		}
+	}
+	if (NEXT_HOOK != NULL)
+		NEXT_HOOK(ADDR);
+}
+
+void blockInit()
+{
+	BLOCKS = NULL;
+	STALE_BLOCKS = NULL;
+	if (MEM_CODE_WRITE != codeWritten)
+	{
+		NEXT_HOOK = MEM_CODE_WRITE;
+		MEM_CODE_WRITE = codeWritten;
+	}
+}
+
+void blockFlush()
+{
+	block *b, *tmp;
+	HASH_ITER(hh, BLOCKS, b, tmp)
+	{
+		HASH_DEL(BLOCKS, b);
+		free(b);
+	}
+	while (STALE_BLOCKS != NULL)
+	{
+		b = STALE_BLOCKS;
+		STALE_BLOCKS = b->nextStale;
+		free(b);
+	}
+	jitReset();
+}
+
+static block *buildBlock(uint32_t pc)
+{
+	decodedInst insts[BLOCK_MAX_INSTS];
+	uint32_t n = 0;
+	uint32_t size;
+	uint32_t addr = pc;
+
+	memMarkCode(pc);
+	do
+	{
+		predecode(fetchWord(addr), &insts[n]);
+		addr += 4;
+	} while (!endsBlock(insts[n++].op) && n < BLOCK_MAX_INSTS && (addr & PAGE_MASK) != 0);
+
+	// Traces show every instruction, so they get the blocks unfused
+	size = n;
+	if (BLOCK_PEEPHOLE && !LOG_ENABLED(LOG_INSTRUCTION))
+		size = predecodeOptimize(insts, n);
+
+	block *b = (block *)malloc(sizeof(block) + size * sizeof(decodedInst));
+	if (b == NULL)
+	{
+		fprintf(stderr, "ERROR: Out of memory for block at 0x%08x!\n", pc);
+		exit(-1);
+	}
+	b->pc = pc;
+	b->count = n;
+	b->size = size;
+	b->hits = 0;
+	b->stale = false;
+	b->native = NULL;
+	memset(b->links, 0, sizeof(b->links));
+	memcpy(b->insts, insts, size * sizeof(decodedInst));
+	HASH_ADD_INT(BLOCKS, pc, b);
+	return b;
+}
+
+static block *findBlock(uint32_t pc)
+{
+	block *b;
+	HASH_FIND_INT(BLOCKS, &pc, b);
+	return (b != NULL) ? b : buildBlock(pc);
+}
+
+// The block that starts at the current PC, following from's links first
+static block *nextBlock(block *from)
+{
+	uint32_t k;
+	block *b;
+	if (from != NULL && !from->stale)
+	{
+		for (k = 0; k < BLOCK_LINKS; k++)
+		{
+			b = from->links[k];
+			if (b != NULL && b->pc == ProgramCounter && !b->stale)
+				return b;
+		}
+	}
+
+	b = findBlock(ProgramCounter);
+	if (from != NULL && !from->stale)
+	{
+		for (k = 0; k < BLOCK_LINKS && from->links[k] != NULL && !from->links[k]->stale; k++)
+			;
+		if (k == BLOCK_LINKS)
+			k = NEXT_LINK++ % BLOCK_LINKS;
+		from->links[k] = b;
+	}
+	return b;
+}
+
+// One instruction through the predecode cache, as the predecode core does
+static void stepOne()
+{
+	jumpStatus = false;
+	decodedInst *d = predecodeFetch(ProgramCounter);
+	if (LOG_ENABLED(LOG_INSTRUCTION))
+		traceInstruction(d->raw);
+	d->handler(d);
+	if (jumpStatus == false)
+		ProgramCounter += 4;
+	if (LOG_ENABLED(LOG_INSTRUCTION))
+		traceRetire();
+}
+
+/*
+ * Runs blocks until *count reaches stop or a memory report is
+ * requested. The budget is checked once per block; a block that would
+ * overrun it is replaced by single steps up to stop, so every run ends
+ * on exactly the instruction the switch core would stop at.
+ */
+void runBlocks(uint32_t *count, uint32_t stop)
+{
+	block *b = NULL;
+	uint32_t k;
+
+	while (*count < stop && !MemReportRequested)
+	{
+		if (ProgramCounter & 3)
+		{
+			stepOne();
+			++*count;
+			b = NULL;
+			continue;
+		}
+
+		b = nextBlock(b);
+		if (stop - *count < b->count)
+		{
+			while (*count < stop)
+			{
+				stepOne();
+				++*count;
+			}
+			return;
+		}
+
+		if (b->native != NULL)
+		{
+			// The block's syscall, if any, is its last instruction and
+			// must see the count it would have under the interpreter
+			uint32_t start = *count;
+			*count = start + b->count - 1;
+			*count = start + b->native(RegFile);
+			continue;
+		}
+		if (CoreMode == CORE_JIT && b->hits++ == JIT_THRESHOLD)
+			b->native = jitCompile(b);
+
+		for (k = 0; k < b->size && !b->stale; k++)
+		{
+			const decodedInst *d = &b->insts[k];
+			jumpStatus = false;
+			if (LOG_ENABLED(LOG_INSTRUCTION))
+				traceInstruction(d->raw);
+			d->handler(d);
+			if (jumpStatus == false)
+				ProgramCounter += 4 * d->width;
+			if (LOG_ENABLED(LOG_INSTRUCTION))
+				traceRetire();
+			*count += d->width;
+		}
+	}
+}
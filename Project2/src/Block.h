@@ -0,0 +1,55 @@
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+#include <stdint.h> /* uint32_t */
+#include <stdbool.h>
+
+#include "Predecode.h"
+#include "Jit.h"
+#include "utils/uthash.h"
+
+/*
+ * Basic-block translation cache. A block is straight-line guest code
+ * from its entry PC up to and including the first branch, jump, jr,
+ * jalr or syscall, cut short at a page boundary or after
+ * BLOCK_MAX_INSTS. It is translated once into a dense array of
+ * predecoded records and cached by entry PC.
+ *
+ * Each block remembers the blocks that last followed it, so a loop or
+ * a common path runs from block to block without a cache lookup. A
+ * store into a page a block was built from marks the block stale: it
+ * leaves the cache, its chain links stop being followed and it stops
+ * after the current instruction if it is the one running.
+ *
+ * Unless tracing per instruction or run with -nopeephole, blocks are
+ * passed through predecodeOptimize when built, so they may hold fewer
+ * records (size) than the instructions they cover (count). The budget
+ * is always counted in instructions.
+ *
+ * Under -core jit, blocks that run often enough are also compiled to
+ * native code (see Jit.h).
+ */
+#define BLOCK_MAX_INSTS 64
+#define BLOCK_LINKS 2
+
+typedef struct block
+{
+	uint32_t pc;
+	uint32_t count;
+	uint32_t size;
+	uint32_t hits;
+	bool stale;
+	jitCode native; /* NULL until compiled by the JIT */
+	struct block *links[BLOCK_LINKS];
+	struct block *nextStale;
+	UT_hash_handle hh;
+	decodedInst insts[];
+} block;
+
+extern bool BLOCK_PEEPHOLE;
+
+extern void blockInit();
+extern void blockFlush();
+extern void runBlocks(uint32_t *count, uint32_t stop);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>	/* FILE, fopen(), snprintf() */
+#include <stdlib.h>
+#include <string.h>	/* memcpy() */
+#include <stdint.h>	/* uint32_t */
+
+#include "RegFile.h"
+#include "Log.h"
+#include "Checkpoint.h"
+#include "utils/guest_memory.h"
+#include "utils/heap.h"
+
+// Page records are tagged so the reader knows where the list ends.
+// A zero record is just the address of a page that reads as zero.
+#define CKPT_PAGE 1
+#define CKPT_ZERO 2
+#define CKPT_END 0
+
+uint32_t CHECKPOINT_SEQ = 0;
+
+static void checkpointName(char *buf, size_t len, const char *prefix, uint32_t seq){
+
+	snprintf(buf, len, "%s.%u.ckpt", prefix, seq);
+
+}
+
+// Write errors are left in ferror(f), which writeCheckpoint checks
+// before the file is renamed into place
+static void writePage(uint32_t ADDR, const uint8_t *data, void *ctx){
+
+	FILE *f = (FILE *) ctx;
+	uint32_t record[2] = {data != NULL ? CKPT_PAGE : CKPT_ZERO, ADDR};
+	fwrite(record, sizeof(record), 1, f);
+	if(data != NULL){
+		fwrite(data, PAGE_SIZE, 1, f);
+	}
+
+}
+
+/*
+ * Writes the next checkpoint of the chain. The file is written under a
+ * temporary name and renamed into place, so a run killed mid-write
+ * leaves the previous checkpoint as the latest valid one.
+ */
+int writeCheckpoint(const char *prefix, uint64_t instructions){
+
+	char name[4096];
+	char tmpName[4096 + 8];
+	ckptHeader header;
+
+	header.magic = CKPT_MAGIC;
+	header.version = CKPT_VERSION;
+	header.kind = (CHECKPOINT_SEQ == 0 || MEM_DIRTY_ALL) ? CKPT_BASE : CKPT_DELTA;
+	header.seq = CHECKPOINT_SEQ;
+	header.instructions = instructions;
+	header.programCounter = ProgramCounter;
+	memcpy(header.regFile, RegFile, sizeof(RegFile));
+
+	checkpointName(name, sizeof(name), prefix, CHECKPOINT_SEQ);
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", name);
+
+	FILE *f = fopen(tmpName, "wb");
+	if(f == NULL){
+		fprintf(stderr, "ERROR: Unable to write checkpoint %s!\n", tmpName);
+		return -1;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+	heapWrite(f);
+	memForEachPage(header.kind == CKPT_DELTA, writePage, f);
+
+	uint32_t trailer[2] = {CKPT_END, CKPT_MAGIC};
+	fwrite(trailer, sizeof(trailer), 1, f);
+
+	if(ferror(f) | fclose(f)){
+		fprintf(stderr, "ERROR: Unable to write checkpoint %s!\n", tmpName);
+		remove(tmpName);
+		return -1;
+	}
+	if(rename(tmpName, name) != 0){
+		fprintf(stderr, "ERROR: Unable to write checkpoint %s!\n", name);
+		return -1;
+	}
+
+	memClearDirty();
+	CHECKPOINT_SEQ++;
+	return 0;
+
+}
+
+// Returns the kind of a complete checkpoint file, or -1
+static int checkpointKind(const char *name){
+
+	ckptHeader header;
+	uint32_t trailer[2];
+	FILE *f = fopen(name, "rb");
+	int kind = -1;
+	if(f == NULL){
+		return -1;
+	}
+	if(fread(&header, sizeof(header), 1, f) == 1 && header.magic == CKPT_MAGIC &&
+	   header.version == CKPT_VERSION && fseek(f, -(long)sizeof(trailer), SEEK_END) == 0 &&
+	   fread(trailer, sizeof(trailer), 1, f) == 1 && trailer[0] == CKPT_END && trailer[1] == CKPT_MAGIC){
+		kind = header.kind;
+	}
+	fclose(f);
+	return kind;
+
+}
+
+static int applyCheckpoint(const char *name, uint64_t *instructions){
+
+	ckptHeader header;
+	uint32_t record[2];
+	FILE *f = fopen(name, "rb");
+	if(f == NULL || fread(&header, sizeof(header), 1, f) != 1 || heapRead(f) != 0){
+		if(f != NULL) fclose(f);
+		return -1;
+	}
+
+	while(fread(record, sizeof(record), 1, f) == 1 && (record[0] == CKPT_PAGE || record[0] == CKPT_ZERO)){
+		if(record[0] == CKPT_ZERO){
+			memDiscard(record[1], PAGE_SIZE);
+			continue;
+		}
+		// Pages are written through the store path so copy-on-write
+		// and TLB bookkeeping stay consistent
+		uint8_t *page = memPageAlloc(record[1]);
+		if(fread(page, PAGE_SIZE, 1, f) != 1){
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	memcpy(RegFile, header.regFile, sizeof(RegFile));
+	ProgramCounter = header.programCounter;
+	*instructions = header.instructions;
+	return 0;
+
+}
+
+/*
+ * Restores the guest from the newest complete checkpoint chain. Guest
+ * memory is rebuilt from scratch, so this must run after LoadOSMemory
+ * and before execution starts.
+ */
+int resumeCheckpoint(const char *prefix, uint64_t *instructions){
+
+	char name[4096];
+	int32_t last = -1;
+	int32_t base;
+	int32_t k;
+
+	for(;;){
+		checkpointName(name, sizeof(name), prefix, last + 1);
+		if(checkpointKind(name) < 0){
+			break;
+		}
+		last++;
+	}
+
+	for(base = last; base >= 0; base--){
+		checkpointName(name, sizeof(name), prefix, base);
+		if(checkpointKind(name) == CKPT_BASE){
+			break;
+		}
+	}
+	if(base < 0){
+		fprintf(stderr, "ERROR: No complete checkpoint found for %s!\n", prefix);
+		return -1;
+	}
+
+	// The loader's regions describe the same program, keep them
+	memRegion regions[MAX_REGIONS];
+	int regionCount = MEM_REGION_COUNT;
+	memcpy(regions, MEM_REGIONS, sizeof(regions));
+	freeMemory();
+	initMemory();
+	memcpy(MEM_REGIONS, regions, sizeof(regions));
+	MEM_REGION_COUNT = regionCount;
+	for(k = base; k <= last; k++){
+		checkpointName(name, sizeof(name), prefix, k);
+		if(applyCheckpoint(name, instructions) != 0){
+			fprintf(stderr, "ERROR: Unable to read checkpoint %s!\n", name);
+			return -1;
+		}
+	}
+
+	LOG(LOG_SUMMARY, "Resumed from %s.%d.ckpt after %llu instructions\n", prefix, last, (unsigned long long)*instructions);
+	memClearDirty();
+	CHECKPOINT_SEQ = last + 1;
+	return 0;
+
+}
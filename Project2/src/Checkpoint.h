@@ -0,0 +1,34 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdint.h> /* uint32_t */
+
+/*
+ * On-disk checkpoints are written as <prefix>.<seq>.ckpt. The first
+ * file of a chain is a base holding every resident guest page; the
+ * following ones are deltas holding only the pages dirtied since the
+ * previous checkpoint. Resuming loads the newest base and replays the
+ * deltas after it in order.
+ */
+#define CKPT_MAGIC 0x454d434b /* "EMCK" */
+#define CKPT_VERSION 6
+#define CKPT_BASE 0
+#define CKPT_DELTA 1
+
+typedef struct ckptHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t kind;
+	uint32_t seq;
+	uint64_t instructions;
+	uint32_t programCounter;
+	int32_t regFile[34];
+} ckptHeader;
+
+// Sequence number of the next checkpoint file
+extern uint32_t CHECKPOINT_SEQ;
+
+extern int writeCheckpoint(const char *prefix, uint64_t instructions);
+extern int resumeCheckpoint(const char *prefix, uint64_t *instructions);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef EXECUTE_H_
+#define EXECUTE_H_
+
+#include <stdint.h> /* uint32_t */
+#include <stdbool.h>
+
+/*
+ * The reference switch interpreter in PROC.c. Other cores reuse it for
+ * the instructions they do not implement themselves, so its quirks
+ * stay the definition of what every core has to produce.
+ */
+typedef struct RType
+{
+	uint32_t opcode;
+	uint32_t rs;
+	uint32_t rt;
+	uint32_t rd;
+	uint32_t shamt;
+	uint32_t funct;
+} RType;
+
+typedef struct IType
+{
+	uint32_t opcode;
+	uint32_t rs;
+	uint32_t rt;
+	uint32_t immediate;
+} IType;
+
+typedef struct JType
+{
+	uint32_t opcode;
+	uint32_t address;
+} JType;
+
+// Set by taken jumps so the main loop does not add 4 to the PC
+extern bool jumpStatus;
+
+// Interpreter cores selectable with -core
+#define CORE_SWITCH 0
+#define CORE_PREDECODE 1
+#define CORE_THREADED 2
+#define CORE_BLOCK 3
+#define CORE_JIT 4
+
+extern int CoreMode;
+
+extern RType decodeR(uint32_t inst);
+extern IType decodeI(uint32_t inst);
+extern JType decodeJ(uint32_t inst);
+
+extern void executeR(RType r);
+extern void executeI(IType i);
+extern void executeJ(JType j);
+
+extern void printInstruction(uint32_t inst);
+
+#endif
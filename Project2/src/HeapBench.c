@@ -0,0 +1,154 @@
+#include <stdio.h>	/* printf(), fopen() */
+#include <stdlib.h>	/* malloc() */
+#include <stdint.h>	/* uint32_t */
+#include <string.h>	/* strcmp() */
+#include <time.h>	/* clock_gettime() */
+
+#include "Log.h"
+#include "elf_reader/elf_reader.h"
+#include "utils/heap.h"
+
+/*
+ * Replays a trace recorded with -heaptrace against each guest heap
+ * allocator and reports the time per call and the peak footprint.
+ * Frees are matched to their mallocs before the clock starts, so the
+ * timed loop only contains allocator calls.
+ */
+
+typedef struct traceAddr {
+	uint32_t addr;
+	uint32_t index;
+	UT_hash_handle hh;
+} traceAddr;
+
+static const char *MODE_NAMES[] = {"seg", "buddy"};
+
+// For every free or realloc, the index of the call that returned its block (or UINT32_MAX)
+static uint32_t *pairFrees(const heap_trace_rec *recs, uint32_t count){
+
+	uint32_t *pair = malloc(sizeof(uint32_t) * (count + 1));
+	traceAddr *live = NULL, *t, *tmp;
+	uint32_t i;
+	for(i = 0; i < count; i++){
+		pair[i] = UINT32_MAX;
+		if(recs[i].op == HEAP_TRACE_FREE || recs[i].op == HEAP_TRACE_REALLOC){
+			HASH_FIND_INT(live, &recs[i].addr, t);
+			if(t != NULL){
+				pair[i] = t->index;
+				HASH_DEL(live, t);
+				free(t);
+			}
+		}
+		if((recs[i].op == HEAP_TRACE_MALLOC || recs[i].op == HEAP_TRACE_REALLOC) && recs[i].result != 0){
+			t = malloc(sizeof(traceAddr));
+			t->addr = recs[i].result;
+			t->index = i;
+			HASH_ADD_INT(live, addr, t);
+		}
+	}
+	HASH_ITER(hh, live, t, tmp){
+		HASH_DEL(live, t);
+		free(t);
+	}
+	return pair;
+
+}
+
+static void replay(const heap_trace_rec *recs, const uint32_t *pair, uint32_t count, int mode){
+
+	uint32_t *result = calloc(count + 1, sizeof(uint32_t));
+	uint32_t peakTop = 0, failed = 0, i;
+	struct timespec start, end;
+
+	initMemory();
+	initHeap();
+	HEAP_MODE = mode;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++){
+		switch(recs[i].op){
+		case HEAP_TRACE_MALLOC:
+			result[i] = mm_malloc(recs[i].size);
+			if(result[i] == 0) failed++;
+			if(HEAP_TOP > peakTop) peakTop = HEAP_TOP;
+			break;
+		case HEAP_TRACE_FREE:
+			if(pair[i] != UINT32_MAX && result[pair[i]] != 0) mm_free(result[pair[i]]);
+			break;
+		case HEAP_TRACE_REALLOC:
+			result[i] = mm_realloc(pair[i] != UINT32_MAX ? result[pair[i]] : 0, recs[i].size);
+			if(HEAP_TOP > peakTop) peakTop = HEAP_TOP;
+			break;
+		case HEAP_TRACE_SBRK:
+			mm_sbrk(recs[i].size);
+			break;
+		case HEAP_TRACE_BRK:
+			mm_brk(recs[i].size);
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("%-8s %10u %10.1f %12u %12zu %8u\n", MODE_NAMES[mode], count,
+		count ? ns / count : 0.0, peakTop ? (peakTop - (uint32_t)exec.HEAPSTART) / 1024 : 0,
+		heapMetadataBytes() / 1024, failed);
+
+	heapCleanUp();
+	freeMemory();
+	free(result);
+
+}
+
+int main(int argc, char *argv[]){
+
+	heap_trace_header header;
+	heap_trace_rec *recs;
+	uint32_t *pair;
+	long size;
+	uint32_t count;
+	FILE *f;
+	int m, a;
+
+	if(argc < 2){
+		fprintf(stderr, "Expected: trace-file [seg|buddy ...]\n");
+		return -1;
+	}
+	f = fopen(argv[1], "rb");
+	if(f == NULL || fread(&header, sizeof(header), 1, f) != 1 ||
+	   header.magic != HEAP_TRACE_MAGIC || header.version != HEAP_TRACE_VERSION){
+		fprintf(stderr, "ERROR: %s is not a heap trace!\n", argv[1]);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - sizeof(header);
+	fseek(f, sizeof(header), SEEK_SET);
+	count = size / sizeof(heap_trace_rec);
+	recs = malloc(sizeof(heap_trace_rec) * (count + 1));
+	if(fread(recs, sizeof(heap_trace_rec), count, f) != count){
+		fprintf(stderr, "ERROR: Unable to read %s!\n", argv[1]);
+		return -1;
+	}
+	fclose(f);
+
+	exec.HEAPSTART = header.heapStart;
+	exec.BREAKSTART = header.breakStart;
+	exec.GSP = header.stackPointer;
+	pair = pairFrees(recs, count);
+
+	// mm_malloc logs every block it hands out; keep that out of the timing
+	LogLevel = LOG_OFF;
+
+	printf("%-8s %10s %10s %12s %12s %8s\n", "Heap", "Calls", "ns/call", "Peak KB", "Meta KB", "Failed");
+	for(m = 0; m < 2; m++){
+		bool selected = argc == 2;
+		for(a = 2; a < argc; a++){
+			if(strcmp(argv[a], MODE_NAMES[m]) == 0) selected = true;
+		}
+		if(selected) replay(recs, pair, count, m);
+	}
+	free(pair);
+	free(recs);
+	return 0;
+
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>	/* fprintf() */
+#include <stdlib.h>	/* free() */
+#include <stdint.h>	/* uint32_t */
+#include <inttypes.h>	/* PRIu64 */
+
+#include "HeapReport.h"
+#include "utils/heap.h"
+
+/*
+ * Summarizes guest heap usage since startup and lists every block that
+ * is still allocated, with the call site that allocated it. Meant to
+ * run right before CleanUp tears the heap bookkeeping down.
+ */
+void printHeapReport(FILE *out){
+
+	struct heap_block **blocks;
+	uint32_t count, largest, i;
+	uint64_t freeBytes;
+	double frag = heapFragmentation(&freeBytes, &largest);
+	int k;
+
+	fprintf(out, "\n ----- Heap Report ----- \n");
+	fprintf(out, "Allocator:         %s\n", HEAP_MODE == HEAP_MODE_BUDDY ? "buddy" : "segregated");
+	fprintf(out, "Allocations:       %" PRIu64 "\n", HEAP_STATS.allocs);
+	fprintf(out, "Frees:             %" PRIu64 "\n", HEAP_STATS.frees);
+	fprintf(out, "Failed:            %" PRIu64 "\n", HEAP_STATS.failed);
+	fprintf(out, "Live:              %" PRIu64 " bytes in %" PRIu64 " blocks\n",
+		HEAP_STATS.liveBytes, HEAP_STATS.liveBlocks);
+	fprintf(out, "Peak:              %" PRIu64 " bytes\n", HEAP_STATS.peakBytes);
+	fprintf(out, "Free:              %" PRIu64 " bytes, largest block %u\n", freeBytes, largest);
+	fprintf(out, "Fragmentation:     %.3f\n", frag);
+	fprintf(out, "Request sizes:\n");
+	for(k = 0; k < 32; k++){
+		if(HEAP_STATS.histogram[k])
+			fprintf(out, "  %10u+ %10" PRIu64 "\n", 1u << k, HEAP_STATS.histogram[k]);
+	}
+
+	blocks = heapSortedBlocks(&count);
+	fprintf(out, "Leaked blocks:\n");
+	for(i = 0; i < count; i++){
+		if(!blocks[i]->free)
+			fprintf(out, "  0x%08x %10u bytes from pc 0x%08x\n", blocks[i]->addr,
+				blocks[i]->request, blocks[i]->pc);
+	}
+	free(blocks);
+	fflush(out);
+
+}
+
+void writeHeapReportJSON(FILE *out){
+
+	struct heap_block **blocks;
+	uint32_t count, largest, i;
+	uint64_t freeBytes;
+	double frag = heapFragmentation(&freeBytes, &largest);
+	const char *sep = "";
+	int k;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"allocator\": \"%s\",\n", HEAP_MODE == HEAP_MODE_BUDDY ? "buddy" : "segregated");
+	fprintf(out, "  \"allocations\": %" PRIu64 ",\n", HEAP_STATS.allocs);
+	fprintf(out, "  \"frees\": %" PRIu64 ",\n", HEAP_STATS.frees);
+	fprintf(out, "  \"failed\": %" PRIu64 ",\n", HEAP_STATS.failed);
+	fprintf(out, "  \"live_bytes\": %" PRIu64 ",\n", HEAP_STATS.liveBytes);
+	fprintf(out, "  \"live_blocks\": %" PRIu64 ",\n", HEAP_STATS.liveBlocks);
+	fprintf(out, "  \"peak_bytes\": %" PRIu64 ",\n", HEAP_STATS.peakBytes);
+	fprintf(out, "  \"free_bytes\": %" PRIu64 ",\n", freeBytes);
+	fprintf(out, "  \"largest_free\": %u,\n", largest);
+	fprintf(out, "  \"fragmentation\": %.6f,\n", frag);
+	fprintf(out, "  \"histogram\": {");
+	for(k = 0; k < 32; k++){
+		if(HEAP_STATS.histogram[k]){
+			fprintf(out, "%s\"%u\": %" PRIu64, sep, 1u << k, HEAP_STATS.histogram[k]);
+			sep = ", ";
+		}
+	}
+	fprintf(out, "},\n");
+
+	blocks = heapSortedBlocks(&count);
+	fprintf(out, "  \"leaks\": [");
+	sep = "\n";
+	for(i = 0; i < count; i++){
+		if(!blocks[i]->free){
+			fprintf(out, "%s    {\"addr\": %u, \"size\": %u, \"pc\": %u}", sep, blocks[i]->addr,
+				blocks[i]->request, blocks[i]->pc);
+			sep = ",\n";
+		}
+	}
+	free(blocks);
+	fprintf(out, "%s]\n}\n", *sep == ',' ? "\n  " : "");
+	fflush(out);
+
+}
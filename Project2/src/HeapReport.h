@@ -0,0 +1,9 @@
+#ifndef HEAP_REPORT_H_
+#define HEAP_REPORT_H_
+
+#include <stdio.h>	/* FILE */
+
+extern void printHeapReport(FILE *out);
+extern void writeHeapReportJSON(FILE *out);
+
+#endif
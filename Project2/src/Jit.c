@@ -0,0 +1,395 @@
+#include <stdint.h> /* uint32_t */
+#include <stdio.h>	/* fprintf() */
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include "RegFile.h"
+#include "Execute.h"
+#include "Predecode.h"
+#include "Block.h"
+#include "Jit.h"
+#include "Log.h"
+#include "Trace.h"
+
+uint32_t JIT_THRESHOLD = JIT_DEFAULT_THRESHOLD;
+
+#if JIT_SUPPORTED
+
+/*
+ * Code is appended to one RWX buffer and never freed on its own;
+ * jitReset drops it all together with the blocks that point into it.
+ * When the buffer is full further blocks simply stay interpreted.
+ */
+static uint8_t *CODE_BASE = NULL;
+static uint8_t *CODE_PTR = NULL;
+static uint8_t *CODE_END = NULL;
+static bool CODE_FAILED = false;
+
+// Worst case bytes of code per guest instruction, and per block
+#define JIT_INST_BYTES 128
+#define JIT_BLOCK_BYTES 32
+
+#define EAX 0
+#define ECX 1
+
+static void emit8(uint8_t v)
+{
+	*CODE_PTR++ = v;
+}
+
+static void emit32(uint32_t v)
+{
+	int k;
+	for (k = 0; k < 4; k++)
+		emit8(v >> (8 * k));
+}
+
+static void emit64(uint64_t v)
+{
+	emit32((uint32_t)v);
+	emit32((uint32_t)(v >> 32));
+}
+
+// mov reg32, [rbx + 4 * r]
+static void loadReg(uint8_t reg, uint32_t r)
+{
+	emit8(0x8B);
+	emit8(0x83 | (reg << 3));
+	emit32(4 * r);
+}
+
+// mov [rbx + 4 * r], eax
+static void storeEax(uint32_t r)
+{
+	emit8(0x89);
+	emit8(0x83);
+	emit32(4 * r);
+}
+
+// mov dword [rbx + 4 * r], v
+static void storeImm(uint32_t r, uint32_t v)
+{
+	emit8(0xC7);
+	emit8(0x83);
+	emit32(4 * r);
+	emit32(v);
+}
+
+// mov rax, fn; call rax
+static void callHelper(const void *fn)
+{
+	emit8(0x48);
+	emit8(0xB8);
+	emit64((uintptr_t)fn);
+	emit8(0xFF);
+	emit8(0xD0);
+}
+
+// mov rax, &ProgramCounter; mov dword [rax], pc
+static void setPC(uint32_t pc)
+{
+	emit8(0x48);
+	emit8(0xB8);
+	emit64((uintptr_t)&ProgramCounter);
+	emit8(0xC7);
+	emit8(0x00);
+	emit32(pc);
+}
+
+// mov eax, executed; pop rbx; ret
+static void emitReturn(uint32_t executed)
+{
+	emit8(0xB8);
+	emit32(executed);
+	emit8(0x5B);
+	emit8(0xC3);
+}
+
+// eax = (eax <cond> operand) ? 1 : 0, after a cmp
+static void emitSet(uint8_t cond)
+{
+	emit8(0x0F);
+	emit8(cond);
+	emit8(0xC0);
+	emit8(0x0F);
+	emit8(0xB6);
+	emit8(0xC0);
+}
+
+#define SETL 0x9C
+#define SETB 0x92
+
+// Runs one instruction through its handler, as the interpreters do
+static void jitStep(const decodedInst *d)
+{
+	jumpStatus = false;
+	d->handler(d);
+	if (jumpStatus == false)
+		ProgramCounter += 4 * d->width;
+}
+
+/*
+ * Emits d inline if it only touches registers. Writes to $0 are
+ * dropped exactly where the handlers drop them.
+ */
+static bool emitInline(const decodedInst *d)
+{
+	switch (d->op)
+	{
+	case OP_None:
+		return true;
+
+	case OP_Add:
+	case OP_Sub:
+	case OP_And:
+	case OP_Or:
+	case OP_Xor:
+	case OP_Nor:
+	case OP_Slt:
+	case OP_Sltu:
+		if (d->rd == 0)
+			return true;
+		loadReg(EAX, d->rs);
+		loadReg(ECX, d->rt);
+		switch (d->op)
+		{
+		case OP_Add:
+			emit8(0x01);
+			emit8(0xC8);
+			break;
+		case OP_Sub:
+			emit8(0x29);
+			emit8(0xC8);
+			break;
+		case OP_And:
+			emit8(0x21);
+			emit8(0xC8);
+			break;
+		case OP_Or:
+		case OP_Nor:
+			emit8(0x09);
+			emit8(0xC8);
+			if (d->op == OP_Nor)
+			{
+				emit8(0xF7);
+				emit8(0xD0);
+			}
+			break;
+		case OP_Xor:
+			emit8(0x31);
+			emit8(0xC8);
+			break;
+		default: // slt, sltu
+			emit8(0x39);
+			emit8(0xC8);
+			emitSet(d->op == OP_Slt ? SETL : SETB);
+			break;
+		}
+		storeEax(d->rd);
+		return true;
+
+	case OP_Sll:
+	case OP_Srl:
+	case OP_Sra:
+		if (d->rd == 0)
+			return true;
+		loadReg(EAX, d->rt);
+		emit8(0xC1);
+		emit8(d->op == OP_Sll ? 0xE0 : d->op == OP_Srl ? 0xE8 : 0xF8);
+		emit8(d->shamt);
+		storeEax(d->rd);
+		return true;
+
+	case OP_Sllv:
+	case OP_Srlv:
+	case OP_Srav:
+		// The host masks cl to 5 bits, like the & 0x1F in the handlers
+		if (d->rd == 0)
+			return true;
+		loadReg(EAX, d->rt);
+		loadReg(ECX, d->rs);
+		emit8(0xD3);
+		emit8(d->op == OP_Sllv ? 0xE0 : d->op == OP_Srlv ? 0xE8 : 0xF8);
+		storeEax(d->rd);
+		return true;
+
+	case OP_Mfhi:
+	case OP_Mflo:
+		if (d->rd == 0)
+			return true;
+		loadReg(EAX, d->op == OP_Mfhi ? 32 : 33);
+		storeEax(d->rd);
+		return true;
+
+	case OP_Mthi:
+	case OP_Mtlo:
+		loadReg(EAX, d->rs);
+		storeEax(d->op == OP_Mthi ? 32 : 33);
+		return true;
+
+	case OP_Addi:
+	case OP_Slti:
+	case OP_Sltiu:
+	case OP_Andi:
+	case OP_Ori:
+	case OP_Xori:
+		if (d->rt == 0)
+			return true;
+		loadReg(EAX, d->rs);
+		switch (d->op)
+		{
+		case OP_Addi:
+			emit8(0x05);
+			break;
+		case OP_Andi:
+			emit8(0x25);
+			break;
+		case OP_Ori:
+			emit8(0x0D);
+			break;
+		case OP_Xori:
+			emit8(0x35);
+			break;
+		default: // slti, sltiu
+			emit8(0x3D);
+			break;
+		}
+		emit32(d->imm);
+		if (d->op == OP_Slti || d->op == OP_Sltiu)
+			emitSet(d->op == OP_Slti ? SETL : SETB);
+		storeEax(d->rt);
+		return true;
+
+	case OP_Lui:
+		if (d->rt == 0)
+			return true;
+		storeImm(d->rt, (uint32_t)d->imm << 16);
+		return true;
+
+	case OP_Move:
+		loadReg(EAX, d->rs);
+		storeEax(d->rd);
+		return true;
+
+	case OP_LoadImm:
+		storeImm(d->rd, (uint32_t)d->imm2 << 16);
+		storeImm(d->rt, d->imm);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool isStore(uint8_t op)
+{
+	return op == OP_Sb || op == OP_Sh || op == OP_Sw;
+}
+
+/*
+ * Traces are compiled in only for the log level in effect: with
+ * instruction logging the PC is stored and traceInstruction called
+ * before every instruction, and traceRetire after it. Otherwise the PC
+ * is only stored before handler calls and at the end of the block,
+ * which is where it can be observed.
+ */
+jitCode jitCompile(const block *b)
+{
+	uint32_t k;
+	uint32_t pc = b->pc;
+	uint32_t executed = 0;
+	bool traceInsts = LOG_ENABLED(LOG_INSTRUCTION);
+
+	if (CODE_BASE == NULL)
+	{
+		if (CODE_FAILED)
+			return NULL;
+		void *base = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+						  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+		{
+			fprintf(stderr, "ERROR: Unable to map the JIT code buffer!\n");
+			CODE_FAILED = true;
+			return NULL;
+		}
+		CODE_BASE = CODE_PTR = (uint8_t *)base;
+		CODE_END = CODE_BASE + JIT_BUFFER_SIZE;
+	}
+	if ((size_t)(CODE_END - CODE_PTR) < b->count * JIT_INST_BYTES + JIT_BLOCK_BYTES)
+		return NULL;
+
+	jitCode code = (jitCode)CODE_PTR;
+
+	// push rbx; mov rbx, rdi
+	emit8(0x53);
+	emit8(0x48);
+	emit8(0x89);
+	emit8(0xFB);
+
+	for (k = 0; k < b->size; k++)
+	{
+		const decodedInst *d = &b->insts[k];
+
+		if (traceInsts)
+		{
+			setPC(pc);
+			emit8(0xBF); // mov edi, raw
+			emit32(d->raw);
+			callHelper(traceInstruction);
+		}
+
+		bool inlined = emitInline(d);
+		if (!inlined)
+		{
+			if (!traceInsts)
+				setPC(pc);
+			emit8(0x48); // mov rdi, d
+			emit8(0xBF);
+			emit64((uintptr_t)d);
+			callHelper(jitStep);
+		}
+		else if (k == b->size - 1)
+			setPC(pc + 4 * d->width);
+		pc += 4 * d->width;
+		executed += d->width;
+
+		if (traceInsts)
+			callHelper(traceRetire);
+
+		if (isStore(d->op) && k != b->size - 1)
+		{
+			// mov rax, &b->stale; cmp byte [rax], 0; je past the return
+			emit8(0x48);
+			emit8(0xB8);
+			emit64((uintptr_t)&b->stale);
+			emit8(0x80);
+			emit8(0x38);
+			emit8(0x00);
+			emit8(0x74);
+			emit8(7);
+			emitReturn(executed);
+		}
+	}
+	emitReturn(b->count);
+	return code;
+}
+
+void jitReset()
+{
+	if (CODE_BASE != NULL)
+		munmap(CODE_BASE, JIT_BUFFER_SIZE);
+	CODE_BASE = CODE_PTR = CODE_END = NULL;
+}
+
+#else
+
+jitCode jitCompile(const block *b)
+{
+	return NULL;
+}
+
+void jitReset()
+{
+}
+
+#endif
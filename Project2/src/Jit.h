@@ -0,0 +1,33 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stdint.h> /* uint32_t */
+
+/*
+ * x86-64 JIT tier for the block core. A block that has run
+ * JIT_THRESHOLD times is compiled to native code in an executable
+ * buffer. The generated function keeps RegFile in rbx, does the plain
+ * ALU operations inline and calls the predecoded handler for
+ * everything else (memory, branches, syscalls, HI/LO arithmetic). It
+ * returns the number of instructions it ran: all of them, or fewer if
+ * a store made its own block stale.
+ */
+#if defined(__x86_64__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#define JIT_BUFFER_SIZE ((size_t)16 << 20)
+#define JIT_DEFAULT_THRESHOLD 16
+
+typedef uint32_t (*jitCode)(int32_t *regs);
+
+struct block;
+
+extern uint32_t JIT_THRESHOLD;
+
+extern jitCode jitCompile(const struct block *b);
+extern void jitReset();
+
+#endif
@@ -0,0 +1,18 @@
+#include <string.h> /* strcmp() */
+
+#include "Log.h"
+
+int LogLevel = (LOG_FULL <= LOG_MAX_LEVEL) ? LOG_FULL : LOG_MAX_LEVEL;
+
+// Returns the level called name, or -1 if there is none
+int logLevelFromName(const char *name)
+{
+	static const char *const NAMES[] = {"off", "summary", "instruction", "full"};
+	int level;
+	for (level = LOG_OFF; level <= LOG_FULL; level++)
+	{
+		if (strcmp(name, NAMES[level]) == 0)
+			return level;
+	}
+	return -1;
+}
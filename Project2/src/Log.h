@@ -0,0 +1,42 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdio.h> /* printf() */
+
+/*
+ * Emulator output levels, chosen at run time with -log:
+ *   off          nothing but the guest's own console output
+ *   summary      boot, loader and exit messages, final register dump
+ *   instruction  plus one PC/instruction record per instruction and
+ *                every syscall
+ *   delta        as instruction, but one line per instruction listing
+ *                only what it changed (see Trace.h)
+ *   full         plus a register dump after every instruction (default)
+ *
+ * LOG_MAX_LEVEL caps the level at compile time. Checks above the cap
+ * are constant false, so 'make release' (LOG_MAX_LEVEL=LOG_SUMMARY)
+ * keeps no per-instruction logging code in the cores at all.
+ */
+#define LOG_OFF 0
+#define LOG_SUMMARY 1
+#define LOG_INSTRUCTION 2
+#define LOG_FULL 3
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_FULL
+#endif
+
+#define LOG_ENABLED(level) ((level) <= LOG_MAX_LEVEL && (level) <= LogLevel)
+
+#define LOG(level, ...)               \
+	do                                \
+	{                                 \
+		if (LOG_ENABLED(level))       \
+			printf(__VA_ARGS__);      \
+	} while (0)
+
+extern int LogLevel;
+
+extern int logLevelFromName(const char *name);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>	/* fprintf() */
+#include <stdint.h>	/* uint32_t */
+#include <signal.h>	/* signal() */
+#include <sys/resource.h>	/* getrusage() */
+
+#include "MemReport.h"
+#include "utils/guest_memory.h"
+#include "utils/heap.h"
+
+volatile sig_atomic_t MemReportRequested = 0;
+
+static void requestMemReport(int sig){
+
+	(void) sig;
+	MemReportRequested = 1;
+
+}
+
+// Lets a batch driver ask a running emulator for a report (kill -USR1)
+void initMemReport(){
+
+	signal(SIGUSR1, requestMemReport);
+
+}
+
+// Resident pages per region; the extra last slot counts unclaimed pages
+static void countRegionPage(uint32_t ADDR, const uint8_t *data, void *ctx){
+
+	size_t *pages = (size_t *) ctx;
+	int r;
+	(void) data;
+	for(r = 0; r < MEM_REGION_COUNT; r++){
+		if(ADDR + PAGE_SIZE > MEM_REGIONS[r].start && ADDR < MEM_REGIONS[r].end){
+			break;
+		}
+	}
+	pages[r]++;
+
+}
+
+/*
+ * Breaks resident guest memory down by the regions the loader recorded
+ * (segments, bss, break, heap, stack) and adds the emulator's own
+ * bookkeeping and the process peak RSS.
+ */
+void printMemReport(FILE *out){
+
+	size_t pages[MAX_REGIONS + 1] = {0};
+	size_t total = 0;
+	int r;
+	struct rusage usage;
+
+	memForEachPage(false, countRegionPage, pages);
+
+	fprintf(out, "\n ----- Memory Report ----- \n");
+	fprintf(out, "%-8s %-10s %-10s %10s\n", "Region", "Start", "End", "Resident");
+	for(r = 0; r < MEM_REGION_COUNT; r++){
+		fprintf(out, "%-8s 0x%08x 0x%08x %7zu KB\n", MEM_REGIONS[r].name, MEM_REGIONS[r].start,
+			MEM_REGIONS[r].end, pages[r] * PAGE_SIZE / 1024);
+		total += pages[r];
+	}
+	fprintf(out, "%-8s %-10s %-10s %7zu KB\n", "other", "", "", pages[MEM_REGION_COUNT] * PAGE_SIZE / 1024);
+	total += pages[MEM_REGION_COUNT];
+
+	fprintf(out, "Guest memory resident: %zu KB\n", total * PAGE_SIZE / 1024);
+	if(MEM_BASE == NULL){
+		fprintf(out, "Page table metadata:   %zu KB\n", memMetadataBytes() / 1024);
+		fprintf(out, "Page frame overhead:   %zu KB\n", memFrameOverheadBytes() / 1024);
+	}
+	fprintf(out, "Heap status metadata:  %zu KB\n", heapMetadataBytes() / 1024);
+
+	if(getrusage(RUSAGE_SELF, &usage) == 0){
+		fprintf(out, "Peak RSS:              %ld KB\n", usage.ru_maxrss);
+	}
+	fflush(out);
+
+}
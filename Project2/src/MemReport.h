@@ -0,0 +1,13 @@
+#ifndef MEM_REPORT_H_
+#define MEM_REPORT_H_
+
+#include <stdio.h>	/* FILE */
+#include <signal.h>	/* sig_atomic_t */
+
+// Raised by SIGUSR1; the main loop prints a report when it sees it
+extern volatile sig_atomic_t MemReportRequested;
+
+extern void initMemReport();
+extern void printMemReport(FILE *out);
+
+#endif
@@ -0,0 +1,367 @@
+/*
+ * Instruction operations shared by the interpreter cores, as an X-macro
+ * list: define OP(name, ...) before including this file and every entry
+ * expands to OP(Name, body). The body runs with d pointing at the
+ * predecoded record (see Predecode.h) and must not return.
+ *
+ * Bodies reproduce executeR/executeI/executeJ exactly, including the
+ * places where they write a stale result of 0 into rt or rd (bne, the
+ * REGIMM branches, sb/sh/swl/swr, jr, syscall). Fields are copied out
+ * of the record before any store, because a store into the record's
+ * own page clears it.
+ */
+
+OP(None, )
+
+// rt receives the unused result of an instruction that has no output
+OP(ClearRt,
+	if (d->rt != 0)
+		RegFile[d->rt] = 0;
+)
+
+OP(Add,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rs] + (uint32_t)RegFile[d->rt];
+)
+
+OP(Sub,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rs] - (uint32_t)RegFile[d->rt];
+)
+
+OP(And,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[d->rs] & RegFile[d->rt];
+)
+
+OP(Or,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[d->rs] | RegFile[d->rt];
+)
+
+OP(Xor,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[d->rs] ^ RegFile[d->rt];
+)
+
+OP(Nor,
+	if (d->rd != 0)
+		RegFile[d->rd] = ~(RegFile[d->rs] | RegFile[d->rt]);
+)
+
+OP(Slt,
+	if (d->rd != 0)
+		RegFile[d->rd] = (RegFile[d->rs] < RegFile[d->rt]) ? 1 : 0;
+)
+
+OP(Sltu,
+	if (d->rd != 0)
+		RegFile[d->rd] = ((uint32_t)RegFile[d->rs] < (uint32_t)RegFile[d->rt]) ? 1 : 0;
+)
+
+OP(Sll,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rt] << d->shamt;
+)
+
+OP(Srl,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rt] >> d->shamt;
+)
+
+OP(Sra,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[d->rt] >> d->shamt;
+)
+
+OP(Sllv,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rt] << ((uint32_t)RegFile[d->rs] & 0x1F);
+)
+
+OP(Srlv,
+	if (d->rd != 0)
+		RegFile[d->rd] = (uint32_t)RegFile[d->rt] >> ((uint32_t)RegFile[d->rs] & 0x1F);
+)
+
+OP(Srav,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[d->rt] >> (RegFile[d->rs] & 0x1F);
+)
+
+OP(Mfhi,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[32];
+)
+
+OP(Mthi,
+	RegFile[32] = RegFile[d->rs];
+)
+
+OP(Mflo,
+	if (d->rd != 0)
+		RegFile[d->rd] = RegFile[33];
+)
+
+OP(Mtlo,
+	RegFile[33] = RegFile[d->rs];
+)
+
+OP(Mult,
+	int64_t product = (int64_t)RegFile[d->rs] * (int64_t)RegFile[d->rt];
+	RegFile[33] = (int32_t)(product & 0xFFFFFFFF);
+	RegFile[32] = (int32_t)((product >> 32) & 0xFFFFFFFF);
+)
+
+OP(Multu,
+	uint64_t product = (uint64_t)RegFile[d->rs] * (uint64_t)RegFile[d->rt];
+	RegFile[33] = (uint32_t)(product & 0xFFFFFFFF);
+	RegFile[32] = (uint32_t)((product >> 32) & 0xFFFFFFFF);
+)
+
+// HI gets the upper half of the quotient, as in executeR
+OP(Div,
+	int64_t quotient = (int64_t)RegFile[d->rs] / (int64_t)RegFile[d->rt];
+	RegFile[33] = (int32_t)(quotient & 0xFFFFFFFF);
+	RegFile[32] = (int32_t)((quotient >> 32) & 0xFFFFFFFF);
+)
+
+OP(Divu,
+	uint64_t quotient = (uint64_t)RegFile[d->rs] / (uint64_t)RegFile[d->rt];
+	RegFile[33] = (uint32_t)(quotient & 0xFFFFFFFF);
+	RegFile[32] = (uint32_t)((quotient >> 32) & 0xFFFFFFFF);
+)
+
+// jr leaves jumpStatus clear, so execution resumes at the target + 4
+OP(Jr,
+	ProgramCounter = RegFile[d->rs];
+	if (d->rd != 0)
+		RegFile[d->rd] = 0;
+)
+
+OP(Jalr,
+	uint32_t link = ProgramCounter + 4;
+	if (d->rd == 0)
+		RegFile[31] = link;
+	ProgramCounter = RegFile[d->rs];
+	jumpStatus = true;
+	if (d->rd != 0)
+		RegFile[d->rd] = link;
+)
+
+OP(Syscall,
+	uint32_t rd = d->rd;
+	SyscallExe(RegFile[2]);
+	if (rd != 0)
+		RegFile[rd] = 0;
+)
+
+OP(Break,
+	LOG(LOG_SUMMARY, "Breakpoint found at PC: 0x%08X\n", ProgramCounter);
+	exit(0);
+)
+
+OP(Lb,
+	uint32_t res = readByte(RegFile[d->rs] + d->imm);
+	if (d->rt != 0)
+		RegFile[d->rt] = res;
+)
+
+OP(Lh,
+	uint32_t res = (int16_t)readHalf(RegFile[d->rs] + d->imm);
+	if (d->rt != 0)
+		RegFile[d->rt] = res;
+)
+
+OP(Lw,
+	uint32_t res = readWord(RegFile[d->rs] + d->imm);
+	if (d->rt != 0)
+		RegFile[d->rt] = res;
+)
+
+OP(Lhu,
+	uint32_t res = readHalf(RegFile[d->rs] + d->imm);
+	if (d->rt != 0)
+		RegFile[d->rt] = res;
+)
+
+// lwl and lwr keep their reference implementation
+OP(SwitchI,
+	executeI(decodeI(d->raw));
+)
+
+OP(Sb,
+	uint32_t rt = d->rt;
+	writeByte(RegFile[d->rs] + d->imm, RegFile[rt]);
+	if (rt != 0)
+		RegFile[rt] = 0;
+)
+
+OP(Sh,
+	uint32_t rt = d->rt;
+	writeHalf(RegFile[d->rs] + d->imm, RegFile[rt] & 0xFFFF);
+	if (rt != 0)
+		RegFile[rt] = 0;
+)
+
+OP(Sw,
+	writeWord(RegFile[d->rs] + d->imm, RegFile[d->rt]);
+)
+
+OP(Addi,
+	if (d->rt != 0)
+		RegFile[d->rt] = (uint32_t)RegFile[d->rs] + (uint32_t)d->imm;
+)
+
+OP(Slti,
+	if (d->rt != 0)
+		RegFile[d->rt] = (RegFile[d->rs] < d->imm) ? 1 : 0;
+)
+
+OP(Sltiu,
+	if (d->rt != 0)
+		RegFile[d->rt] = ((uint32_t)RegFile[d->rs] < (uint32_t)d->imm) ? 1 : 0;
+)
+
+// The logical immediates are sign-extended, as in executeI
+OP(Andi,
+	if (d->rt != 0)
+		RegFile[d->rt] = RegFile[d->rs] & d->imm;
+)
+
+OP(Ori,
+	if (d->rt != 0)
+		RegFile[d->rt] = RegFile[d->rs] | d->imm;
+)
+
+OP(Xori,
+	if (d->rt != 0)
+		RegFile[d->rt] = RegFile[d->rs] ^ d->imm;
+)
+
+OP(Lui,
+	if (d->rt != 0)
+		RegFile[d->rt] = (uint32_t)d->imm << 16;
+)
+
+/*
+ * Branches add the offset to the PC of the branch itself; the main
+ * loop then adds 4 as for any other instruction.
+ */
+OP(Bltz,
+	if (RegFile[d->rs] < 0)
+		ProgramCounter += (uint32_t)d->imm << 2;
+)
+
+OP(Bgez,
+	if (RegFile[d->rs] >= 0)
+		ProgramCounter += (uint32_t)d->imm << 2;
+	RegFile[1] = 0;
+)
+
+OP(Bltzal,
+	if (RegFile[d->rs] < 0)
+	{
+		RegFile[31] = ProgramCounter + 4;
+		ProgramCounter += (uint32_t)d->imm << 2;
+	}
+	RegFile[16] = 0;
+)
+
+OP(Bgezal,
+	if (RegFile[d->rs] >= 0)
+	{
+		RegFile[31] = ProgramCounter + 4;
+		ProgramCounter += (uint32_t)d->imm << 2;
+	}
+	RegFile[17] = 0;
+)
+
+OP(Beq,
+	if (RegFile[d->rs] == RegFile[d->rt])
+		ProgramCounter += (uint32_t)d->imm << 2;
+)
+
+OP(Bne,
+	if (RegFile[d->rs] != RegFile[d->rt])
+		ProgramCounter += (uint32_t)d->imm << 2;
+	if (d->rt != 0)
+		RegFile[d->rt] = 0;
+)
+
+OP(Blez,
+	if (RegFile[d->rs] <= 0)
+		ProgramCounter += (uint32_t)d->imm << 2;
+	if (d->rt != 0)
+		RegFile[d->rt] = 0;
+)
+
+OP(Bgtz,
+	if (RegFile[d->rs] > 0)
+		ProgramCounter += (uint32_t)d->imm << 2;
+	if (d->rt != 0)
+		RegFile[d->rt] = 0;
+)
+
+// Jump targets are the raw 26-bit field, as in executeJ
+OP(J,
+	ProgramCounter = d->imm;
+	jumpStatus = true;
+)
+
+OP(Jal,
+	RegFile[31] = ProgramCounter + 4;
+	ProgramCounter = d->imm;
+	jumpStatus = true;
+)
+
+/*
+ * Fused ops, built only by the block peephole pass (see predecodeOptimize).
+ * Each one stands for a run of d->width instructions and runs with the
+ * PC of the first, so the main loop's PC += 4 * width lands after the
+ * run. Both destinations are nonzero wherever they are written.
+ */
+
+// addu/or rd, rs, $zero
+OP(Move,
+	RegFile[d->rd] = RegFile[d->rs];
+)
+
+// lui rd, imm2 followed by ori/addiu rt, rd, lo; imm holds the result
+OP(LoadImm,
+	RegFile[d->rd] = (uint32_t)d->imm2 << 16;
+	RegFile[d->rt] = d->imm;
+)
+
+/*
+ * slt-style compare into rd followed by bne/beq rd, $zero. shamt is
+ * the compare result that takes the branch (1 for bne, 0 for beq) and
+ * imm2 the branch offset, relative here to the compare's own PC.
+ */
+OP(SltBranch,
+	int32_t flag = (RegFile[d->rs] < RegFile[d->rt]) ? 1 : 0;
+	RegFile[d->rd] = flag;
+	if (flag == d->shamt)
+		ProgramCounter += (uint32_t)d->imm2 << 2;
+)
+
+OP(SltuBranch,
+	int32_t flag = ((uint32_t)RegFile[d->rs] < (uint32_t)RegFile[d->rt]) ? 1 : 0;
+	RegFile[d->rd] = flag;
+	if (flag == d->shamt)
+		ProgramCounter += (uint32_t)d->imm2 << 2;
+)
+
+OP(SltiBranch,
+	int32_t flag = (RegFile[d->rs] < d->imm) ? 1 : 0;
+	RegFile[d->rd] = flag;
+	if (flag == d->shamt)
+		ProgramCounter += (uint32_t)d->imm2 << 2;
+)
+
+OP(SltiuBranch,
+	int32_t flag = ((uint32_t)RegFile[d->rs] < (uint32_t)d->imm) ? 1 : 0;
+	RegFile[d->rd] = flag;
+	if (flag == d->shamt)
+		ProgramCounter += (uint32_t)d->imm2 << 2;
+)
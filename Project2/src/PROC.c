@@ -1,47 +1,55 @@
 #include <stdint.h> /* uint32_t */
 #include <stdio.h>	/* fprintf(), printf() */
 #include <stdlib.h> /* atoi() */
+#include <string.h> /* strcmp() */
 #include <math.h>
 
 #include "RegFile.h"
 #include "Syscall.h"
+#include "Checkpoint.h"
+#include "Snapshot.h"
+#include "MemReport.h"
+#include "HeapReport.h"
+#include "Execute.h"
+#include "Predecode.h"
+#include "Threaded.h"
+#include "Block.h"
+#include "Jit.h"
+#include "Log.h"
+#include "Trace.h"
 #include "elf_reader/elf_reader.h"
 #include "utils/heap.h"
 
-uint32_t ProgramCounter;
 bool jumpStatus;
 
-typedef struct RType
-{
-	uint32_t opcode;
-	uint32_t rs;
-	uint32_t rt;
-	uint32_t rd;
-	uint32_t shamt;
-	uint32_t funct;
-} RType;
-
-typedef struct IType
-{
-	uint32_t opcode;
-	uint32_t rs;
-	uint32_t rt;
-	uint32_t immediate;
-} IType;
+// Interpreter core (-core); the switch core decodes every instruction
+int CoreMode = CORE_PREDECODE;
 
-typedef struct JType
-{
-	uint32_t opcode;
-	uint32_t address;
-} JType;
+// Periodic on-disk checkpoints (-ckpt) and resume (-resume)
+uint32_t CheckpointInterval = 0;
+const char *CheckpointPrefix = NULL;
+const char *ResumePrefix = NULL;
 
-RType decodeR(uint32_t inst);
-IType decodeI(uint32_t inst);
-JType decodeJ(uint32_t inst);
+// Snapshot at instruction SnapshotAt and rewind to it once at RewindAt
+// (-snapshot); RewindAt is 0 when unused or done
+uint32_t SnapshotAt = 0;
+uint32_t RewindAt = 0;
 
-void executeR(RType r);
-void executeI(IType i);
-void executeJ(JType j);
+// Print a memory report at the end of the run (-memreport)
+bool MemReportAtExit = false;
+bool HeapReportAtExit = false;
+const char *HeapReportJSON = NULL;
+const char *HeapTracePath = NULL;
+
+// The instruction count and any snapshot still waiting for its rewind,
+// where the exit syscall's end-of-run hook can reach them
+static uint32_t *RunCount;
+static Snapshot *PendingSnapshot = NULL;
+
+void printUsage();
+int parseOptions(int argc, char *argv[]);
+void finishRun(uint32_t count);
+void exitRun();
 
 int main(int argc, char *argv[])
 {
@@ -73,17 +81,27 @@ int main(int argc, char *argv[])
 
 		// PRINT ERROR AND TERMINATE
 		fprintf(stderr, "ERROR: Input argument missing!\n");
-		fprintf(stderr, "Expected: file-name, max-instructions\n");
+		printUsage();
 		return -1;
 	}
 
 	// CONVERT MAX INSTRUCTIONS FROM STRING TO INTEGER
 	MaxInstructions = atoi(argv[2]);
 
+	// PARSE OPTIONAL FLAGS FOLLOWING THE REQUIRED ARGUMENTS
+	if (parseOptions(argc, argv) < 0)
+	{
+		printUsage();
+		return -1;
+	}
+
 	// Open file pointers & initialize Heap & Regsiters
 	initHeap();
 	initFDT();
 	initRegFile(0);
+	initMemReport();
+	predecodeInit();
+	blockInit();
 
 	// LOAD ELF FILE INTO MEMORY AND STORE EXIT STATUS
 	int status = LoadOSMemory(argv[1]);
@@ -96,52 +114,311 @@ int main(int argc, char *argv[])
 		return status;
 	}
 
-	printf("\n ----- BOOT Sequence ----- \n");
-	printf("Initializing sp=0x%08x; gp=0x%08x; start=0x%08x\n", exec.GSP, exec.GP,
+	if (HeapTracePath != NULL && heapTraceOpen(HeapTracePath) < 0)
+		return -1;
+
+	LOG(LOG_SUMMARY, "\n ----- BOOT Sequence ----- \n");
+	LOG(LOG_SUMMARY, "Initializing sp=0x%08x; gp=0x%08x; start=0x%08x\n", exec.GSP, exec.GP,
 		   exec.GPC_START);
 
 	RegFile[28] = exec.GP;
 	RegFile[29] = exec.GSP;
 	RegFile[31] = exec.GPC_START;
 
-	printRegFile();
+	if (LOG_ENABLED(LOG_SUMMARY))
+		printRegFile();
 
-	printf("\n ----- Execute Program ----- \n");
-	printf("Max Instruction to run = %d \n", MaxInstructions);
+	LOG(LOG_SUMMARY, "\n ----- Execute Program ----- \n");
+	LOG(LOG_SUMMARY, "Max Instruction to run = %d \n", MaxInstructions);
 	fflush(stdout);
 	ProgramCounter = exec.GPC_START;
 
-	int i;
-	for (i = 0; i < MaxInstructions; i++)
+	uint64_t startCount = 0;
+	if (ResumePrefix != NULL && resumeCheckpoint(ResumePrefix, &startCount) < 0)
+		return -1;
+
+	uint64_t nextCheckpoint = CheckpointInterval ? startCount + CheckpointInterval : UINT64_MAX;
+
+	uint32_t i = startCount;
+	RunCount = &i;
+	SYSCALL_EXIT = exitRun;
+	HEAP_TRACE_CLOCK = &i;
+	while (i < MaxInstructions)
 	{
-		jumpStatus = false;
-		CurrentInstruction = readWord(ProgramCounter, false); // Fetch instruction at 'ProgramCounter'
-		uint32_t initOpcode = (CurrentInstruction >> 26) & 0x3F;
+		if (i == nextCheckpoint)
+		{
+			writeCheckpoint(CheckpointPrefix, i);
+			nextCheckpoint += CheckpointInterval;
+		}
 
-		printf("Program Counter: %d\n", ProgramCounter);
-		printf("Current Instruction: %x\n", CurrentInstruction);
-		printf("Initi Opcode: %x", initOpcode);
+		// Guest memory, registers and heap go back; open files and
+		// output already written do not
+		if (RewindAt != 0 && PendingSnapshot == NULL && i == SnapshotAt && (PendingSnapshot = takeSnapshot()) == NULL)
+		{
+			fprintf(stderr, "ERROR: Unable to take a snapshot at instruction %u!\n", i);
+			return -1;
+		}
+		if (PendingSnapshot != NULL && i == RewindAt)
+		{
+			restoreSnapshot(PendingSnapshot);
+			freeSnapshot(PendingSnapshot);
+			PendingSnapshot = NULL;
+			RewindAt = 0;
+			LOG(LOG_SUMMARY, "Rewound from instruction %u to the snapshot at %u\n", i, SnapshotAt);
+			i = SnapshotAt;
+		}
 
-		if (initOpcode == 0x00)
+		if (MemReportRequested)
 		{
-			executeR(decodeR(CurrentInstruction));
+			MemReportRequested = 0;
+			printMemReport(stderr);
+		}
+
+		// The threaded, block and JIT cores run up to the next checkpoint,
+		// snapshot point or the end of the budget
+		uint32_t stop = (nextCheckpoint < MaxInstructions) ? nextCheckpoint : MaxInstructions;
+		if (RewindAt != 0)
+		{
+			uint32_t event = (PendingSnapshot == NULL) ? SnapshotAt : RewindAt;
+			if (event > i && event < stop)
+				stop = event;
+		}
+		if (CoreMode == CORE_THREADED)
+		{
+			runThreaded(&i, stop);
+			continue;
+		}
+		if (CoreMode == CORE_BLOCK || CoreMode == CORE_JIT)
+		{
+			runBlocks(&i, stop);
+			continue;
+		}
+
+		jumpStatus = false;
+		if (CoreMode == CORE_PREDECODE)
+		{
+			decodedInst *d = predecodeFetch(ProgramCounter);
+			if (LOG_ENABLED(LOG_INSTRUCTION))
+				traceInstruction(d->raw);
+			d->handler(d);
 		}
-		else if (initOpcode == 0x02 || initOpcode == 0x03)
-			executeJ(decodeJ(CurrentInstruction));
 		else
-			executeI(decodeI(CurrentInstruction));
+		{
+			CurrentInstruction = fetchWord(ProgramCounter); // Fetch instruction at 'ProgramCounter'
+			uint32_t initOpcode = (CurrentInstruction >> 26) & 0x3F;
+
+			if (LOG_ENABLED(LOG_INSTRUCTION))
+				traceInstruction(CurrentInstruction);
+
+			if (initOpcode == 0x00)
+			{
+				executeR(decodeR(CurrentInstruction));
+			}
+			else if (initOpcode == 0x02 || initOpcode == 0x03)
+				executeJ(decodeJ(CurrentInstruction));
+			else
+				executeI(decodeI(CurrentInstruction));
+		}
 
 		if (jumpStatus == false)
 			ProgramCounter += 4;
 
+		if (LOG_ENABLED(LOG_INSTRUCTION))
+			traceRetire();
+		i++;
+	}
+
+	finishRun(i);
+
+	return 0;
+}
+
+/*
+ * End-of-run reporting, shared by the end of the instruction budget and
+ * the guest's own exit syscall, which never returns to main.
+ */
+void finishRun(uint32_t count)
+{
+	// Without per-instruction dumps, show where the run ended
+	if (LOG_ENABLED(LOG_SUMMARY) && !LOG_ENABLED(LOG_FULL))
+	{
+		printf("\n ----- Execution Summary ----- \n");
+		printf("Instructions executed: %u\n", count);
+		printf("Program Counter: 0x%08x\n", ProgramCounter);
 		printRegFile();
 	}
+	if (MemReportAtExit)
+		printMemReport(stdout);
+	if (HeapReportAtExit)
+		printHeapReport(stdout);
+	if (HeapReportJSON != NULL)
+	{
+		FILE *json = fopen(HeapReportJSON, "w");
+		if (json == NULL)
+			fprintf(stderr, "ERROR: Unable to write heap report to %s!\n", HeapReportJSON);
+		else
+		{
+			writeHeapReportJSON(json);
+			fclose(json);
+		}
+	}
+
+	freeSnapshot(PendingSnapshot);
+	PendingSnapshot = NULL;
+	heapTraceClose();
+	blockFlush();
+	predecodeFlush();
 	closeFDT(); // Close file pointers & free allocated Memory
 	CleanUp();
 
+	if (MEM_HUGEPAGES)
+		printMemSummary();
+}
+
+// The exit syscall itself counts as executed
+void exitRun()
+{
+	finishRun(*RunCount + 1);
+}
+
+void printUsage()
+{
+	fprintf(stderr, "Expected: file-name, max-instructions [options]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -core NAME         switch|predecode|threaded|block|jit (default predecode)\n");
+	fprintf(stderr, "  -jit N             compile blocks after N runs under -core jit (default %d)\n",
+			JIT_DEFAULT_THRESHOLD);
+	fprintf(stderr, "  -nopeephole        do not fuse instructions in blocks and JIT code\n");
+	fprintf(stderr, "  -log LEVEL         off|summary|instruction|delta|full (default full)\n");
+	fprintf(stderr, "  -mem paged|flat    guest memory backend (default paged)\n");
+	fprintf(stderr, "  -hugepages         back guest RAM with 2 MB pages\n");
+	fprintf(stderr, "  -heap seg|buddy    guest heap allocator (default seg)\n");
+	fprintf(stderr, "  -memreport         print guest memory usage at exit (or on SIGUSR1)\n");
+	fprintf(stderr, "  -heapreport        print heap statistics and leaked blocks at exit\n");
+	fprintf(stderr, "  -heapjson file     write the heap report as JSON at exit\n");
+	fprintf(stderr, "  -heaptrace file    record heap calls for replay with heapbench\n");
+	fprintf(stderr, "  -ckpt N prefix     write a checkpoint every N instructions\n");
+	fprintf(stderr, "  -resume prefix     resume from the latest checkpoint\n");
+	fprintf(stderr, "  -snapshot N M      snapshot at instruction N and rewind to it once at M\n");
+}
+
+int parseOptions(int argc, char *argv[])
+{
+	int a;
+	for (a = 3; a < argc; a++)
+	{
+		if (strcmp(argv[a], "-core") == 0 && a + 1 < argc)
+		{
+			a++;
+			if (strcmp(argv[a], "switch") == 0)
+				CoreMode = CORE_SWITCH;
+			else if (strcmp(argv[a], "predecode") == 0)
+				CoreMode = CORE_PREDECODE;
+			else if (strcmp(argv[a], "threaded") == 0)
+				CoreMode = CORE_THREADED;
+			else if (strcmp(argv[a], "block") == 0)
+				CoreMode = CORE_BLOCK;
+			else if (strcmp(argv[a], "jit") == 0 && JIT_SUPPORTED)
+				CoreMode = CORE_JIT;
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown interpreter core %s!\n", argv[a]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[a], "-log") == 0 && a + 1 < argc)
+		{
+			a++;
+			// Only the last -log counts, so the trace mode is set up below
+			DeltaTrace = strcmp(argv[a], "delta") == 0;
+			if (DeltaTrace)
+				LogLevel = LOG_INSTRUCTION;
+			else if ((LogLevel = logLevelFromName(argv[a])) < 0)
+			{
+				fprintf(stderr, "ERROR: Unknown log level %s!\n", argv[a]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[a], "-jit") == 0 && a + 1 < argc)
+			JIT_THRESHOLD = atoi(argv[++a]);
+		else if (strcmp(argv[a], "-nopeephole") == 0)
+			BLOCK_PEEPHOLE = false;
+		else if (strcmp(argv[a], "-mem") == 0 && a + 1 < argc)
+		{
+			a++;
+			if (strcmp(argv[a], "paged") == 0)
+				MEM_BACKEND = MEM_BACKEND_PAGED;
+			else if (strcmp(argv[a], "flat") == 0)
+				MEM_BACKEND = MEM_BACKEND_FLAT;
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown memory backend %s!\n", argv[a]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[a], "-hugepages") == 0)
+			MEM_HUGEPAGES = true;
+		else if (strcmp(argv[a], "-heap") == 0 && a + 1 < argc)
+		{
+			a++;
+			if (strcmp(argv[a], "seg") == 0)
+				HEAP_MODE = HEAP_MODE_SEGREGATED;
+			else if (strcmp(argv[a], "buddy") == 0)
+				HEAP_MODE = HEAP_MODE_BUDDY;
+			else
+			{
+				fprintf(stderr, "ERROR: Unknown heap allocator %s!\n", argv[a]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[a], "-memreport") == 0)
+			MemReportAtExit = true;
+		else if (strcmp(argv[a], "-heapreport") == 0)
+			HeapReportAtExit = true;
+		else if (strcmp(argv[a], "-heapjson") == 0 && a + 1 < argc)
+			HeapReportJSON = argv[++a];
+		else if (strcmp(argv[a], "-heaptrace") == 0 && a + 1 < argc)
+			HeapTracePath = argv[++a];
+		else if (strcmp(argv[a], "-ckpt") == 0 && a + 2 < argc)
+		{
+			CheckpointInterval = atoi(argv[++a]);
+			CheckpointPrefix = argv[++a];
+		}
+		else if (strcmp(argv[a], "-resume") == 0 && a + 1 < argc)
+			ResumePrefix = argv[++a];
+		else if (strcmp(argv[a], "-snapshot") == 0 && a + 2 < argc)
+		{
+			SnapshotAt = atoi(argv[++a]);
+			RewindAt = atoi(argv[++a]);
+			if (RewindAt <= SnapshotAt)
+			{
+				fprintf(stderr, "ERROR: -snapshot needs N < M!\n");
+				return -1;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "ERROR: Unknown option %s!\n", argv[a]);
+			return -1;
+		}
+	}
+	if (DeltaTrace)
+		traceDeltaInit();
 	return 0;
 }
 
+// The per-instruction trace every core prints before executing
+void printInstruction(uint32_t inst)
+{
+	uint32_t opcode = (inst >> 26) & 0x3F;
+
+	printf("Program Counter: %d\n", ProgramCounter);
+	printf("Current Instruction: %x\n", inst);
+	printf("Initi Opcode: %x", opcode);
+	if (opcode == 0x00)
+		printf("\nFunction: %d", inst & 0x3F);
+}
+
 RType decodeR(uint32_t inst)
 {
 	RType rInstruction = {
@@ -180,7 +457,6 @@ JType decodeJ(uint32_t inst)
 
 void executeR(RType r)
 {
-	printf("\nFunction: %d", r.funct);
 	uint32_t res = 0;
 	bool writeRegister = true;
 	int64_t product = 0;
@@ -316,7 +592,7 @@ void executeR(RType r)
 		break;
 
 	case 0x0D: // breakpoint
-		printf("Breakpoint found at PC: 0x%08X\n", ProgramCounter);
+		LOG(LOG_SUMMARY, "Breakpoint found at PC: 0x%08X\n", ProgramCounter);
 		exit(0);
 		break;
 
@@ -338,9 +614,6 @@ void executeI(IType i)
 	uint32_t res = 0;
 	uint32_t addr = 0;
 	bool writeRegister = true;
-	uint8_t high;
-	uint8_t low;
-	uint16_t combinedHalf;
 	uint32_t combinedWord;
 	uint16_t offset;
 	uint32_t byteOffset;
@@ -349,15 +622,11 @@ void executeI(IType i)
 	switch (i.opcode)
 	{
 	case 0x20: // lb
-		res = readByte(RegFile[i.rs] + (int16_t)i.immediate, false);
+		res = readByte(RegFile[i.rs] + (int16_t)i.immediate);
 		break;
 
 	case 0x21: // lh
-		addr = RegFile[i.rs] + (int16_t)i.immediate;
-		high = readByte(addr, false);
-		low = readByte(addr + 1, false);
-		combinedHalf = (high << 8) | low;
-		res = (int16_t)combinedHalf;
+		res = (int16_t)readHalf(RegFile[i.rs] + (int16_t)i.immediate);
 		break;
 
 	case 0x22: // lwl
@@ -370,7 +639,7 @@ void executeI(IType i)
 			combinedWord = 0;
 			for (int i = addr; i < addr + byteOffset; i++)
 			{
-				combinedWord = (combinedWord << 8) | readByte(addr + i, false);
+				combinedWord = (combinedWord << 8) | readByte(addr + i);
 			}
 
 			uint32_t shift = (offset % 4) * 8;
@@ -380,19 +649,15 @@ void executeI(IType i)
 		break;
 
 	case 0x23: // lw
-		res = readWord(RegFile[i.rs] + (int16_t)i.immediate, false);
+		res = readWord(RegFile[i.rs] + (int16_t)i.immediate);
 		break;
 
 	case 0x24: // lbu
-		res = (uint8_t)readByte(RegFile[i.rs] + (int16_t)i.immediate, false);
+		res = (uint8_t)readByte(RegFile[i.rs] + (int16_t)i.immediate);
 		break;
 
 	case 0x25: // lhu
-		addr = RegFile[i.rs] + (int16_t)i.immediate;
-		high = readByte(addr, false);
-		low = readByte(addr + 1, false);
-		combinedHalf = (high << 8) | low;
-		res = (uint16_t)combinedHalf;
+		res = readHalf(RegFile[i.rs] + (int16_t)i.immediate);
 		break;
 
 	case 0x26: // lwr
@@ -406,7 +671,7 @@ void executeI(IType i)
 			combinedWord = 0;
 			for (int i = addr - byteOffset; i <= addr; i++)
 			{
-				combinedWord = (combinedWord << 8) | readByte(addr + i, false);
+				combinedWord = (combinedWord << 8) | readByte(addr + i);
 			}
 
 			mask = (pow(2, 33) - 1) - (pow(2, (byteOffset + 1) * 8) - 1);
@@ -415,22 +680,18 @@ void executeI(IType i)
 		break;
 
 	case 0x28: // sb
-		writeByte(RegFile[i.rs] + (int16_t)i.immediate, RegFile[i.rt], false);
+		writeByte(RegFile[i.rs] + (int16_t)i.immediate, RegFile[i.rt]);
 		break;
 
 	case 0x29: // sh
-		addr = RegFile[i.rs] + (int16_t)i.immediate;
-		high = (uint8_t)(RegFile[i.rt] >> 24) & 0xFF;
-		low = (uint8_t)(RegFile[i.rt] >> 16) & 0xFF;
-		writeByte(addr, high, false);
-		writeByte(addr + 1, low, false);
+		writeHalf(RegFile[i.rs] + (int16_t)i.immediate, RegFile[i.rt] & 0xFFFF);
 		break;
 
 	case 0x2A: // swl
 		break;
 
 	case 0x2B: // sw
-		writeWord(RegFile[i.rs] + (int16_t)i.immediate, RegFile[i.rt], false);
+		writeWord(RegFile[i.rs] + (int16_t)i.immediate, RegFile[i.rt]);
 		writeRegister = false;
 		break;
 
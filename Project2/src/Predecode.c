@@ -0,0 +1,304 @@
+#include <stdint.h> /* uint32_t */
+#include <stdio.h>	/* fprintf() */
+#include <stdlib.h> /* exit(), calloc(), free() */
+#include <string.h> /* memset() */
+
+#include "RegFile.h"
+#include "Syscall.h"
+#include "Execute.h"
+#include "Predecode.h"
+#include "Log.h"
+#include "utils/arena.h"
+#include "utils/guest_memory.h"
+
+#define OP(name, ...) \
+	static void op##name(const decodedInst *d) { __VA_ARGS__ }
+#include "Ops.h"
+#undef OP
+
+static const instHandler HANDLERS[OP_COUNT] = {
+#define OP(name, ...) op##name,
+#include "Ops.h"
+#undef OP
+};
+
+// Indexed by funct; unlisted functs (0, OP_None) do nothing
+static const uint8_t R_OPS[64] = {
+	[0x20] = OP_Add, [0x21] = OP_Add, [0x22] = OP_Sub, [0x23] = OP_Sub,
+	[0x24] = OP_And, [0x25] = OP_Or, [0x26] = OP_Xor, [0x27] = OP_Nor,
+	[0x2A] = OP_Slt, [0x2B] = OP_Sltu,
+	[0x00] = OP_Sll, [0x02] = OP_Srl, [0x03] = OP_Sra,
+	[0x04] = OP_Sllv, [0x06] = OP_Srlv, [0x07] = OP_Srav,
+	[0x10] = OP_Mfhi, [0x11] = OP_Mthi, [0x12] = OP_Mflo, [0x13] = OP_Mtlo,
+	[0x18] = OP_Mult, [0x19] = OP_Multu, [0x1A] = OP_Div, [0x1B] = OP_Divu,
+	[0x08] = OP_Jr, [0x09] = OP_Jalr, [0x0C] = OP_Syscall, [0x0D] = OP_Break,
+};
+
+// Indexed by opcode; REGIMM (0x01) is split on rt in predecode
+static const uint8_t I_OPS[64] = {
+	[0x20] = OP_Lb, [0x21] = OP_Lh, [0x22] = OP_SwitchI, [0x23] = OP_Lw,
+	[0x24] = OP_Lb, [0x25] = OP_Lhu, [0x26] = OP_SwitchI,
+	[0x28] = OP_Sb, [0x29] = OP_Sh, [0x2A] = OP_ClearRt, [0x2B] = OP_Sw,
+	[0x2E] = OP_ClearRt,
+	[0x08] = OP_Addi, [0x09] = OP_Addi, [0x0A] = OP_Slti, [0x0B] = OP_Sltiu,
+	[0x0C] = OP_Andi, [0x0D] = OP_Ori, [0x0E] = OP_Xori, [0x0F] = OP_Lui,
+	[0x04] = OP_Beq, [0x05] = OP_Bne, [0x06] = OP_Blez, [0x07] = OP_Bgtz,
+};
+
+void predecode(uint32_t inst, decodedInst *d)
+{
+	uint32_t opcode = (inst >> 26) & 0x3F;
+
+	d->raw = inst;
+	d->rs = (inst >> 21) & 0x1F;
+	d->rt = (inst >> 16) & 0x1F;
+	d->rd = (inst >> 11) & 0x1F;
+	d->shamt = (inst >> 6) & 0x1F;
+	d->imm = (int16_t)(inst & 0xFFFF);
+	d->width = 1;
+	d->imm2 = 0;
+
+	if (opcode == 0x00)
+		d->op = R_OPS[inst & 0x3F];
+	else if (opcode == 0x02 || opcode == 0x03)
+	{
+		d->imm = inst & 0x3FFFFFF;
+		d->op = (opcode == 0x02) ? OP_J : OP_Jal;
+	}
+	else if (opcode == 0x01)
+	{
+		if (d->rt == 0)
+			d->op = OP_Bltz;
+		else if (d->rt == 1)
+			d->op = OP_Bgez;
+		else if (d->rt == 16)
+			d->op = OP_Bltzal;
+		else if (d->rt == 17)
+			d->op = OP_Bgezal;
+		else
+			d->op = OP_ClearRt;
+	}
+	else
+		d->op = I_OPS[opcode];
+
+	d->handler = HANDLERS[d->op];
+}
+
+// Records that change nothing: ALU results thrown away into $0
+static bool isNop(const decodedInst *d)
+{
+	switch (d->op)
+	{
+	case OP_None:
+		return true;
+	case OP_Add:
+	case OP_Sub:
+	case OP_And:
+	case OP_Or:
+	case OP_Xor:
+	case OP_Nor:
+	case OP_Slt:
+	case OP_Sltu:
+	case OP_Sll:
+	case OP_Srl:
+	case OP_Sra:
+	case OP_Sllv:
+	case OP_Srlv:
+	case OP_Srav:
+	case OP_Mfhi:
+	case OP_Mflo:
+		return d->rd == 0;
+	case OP_ClearRt:
+	case OP_Addi:
+	case OP_Slti:
+	case OP_Sltiu:
+	case OP_Andi:
+	case OP_Ori:
+	case OP_Xori:
+	case OP_Lui:
+		return d->rt == 0;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Whether nops after d may run as part of it. Not after anything that
+ * can write guest memory: a store may rewrite the nops themselves, and
+ * the block stops right after it when it does.
+ */
+static bool canAbsorb(const decodedInst *d)
+{
+	return d->op != OP_Sb && d->op != OP_Sh && d->op != OP_Sw && d->op != OP_Syscall;
+}
+
+// Fuses a and the b after it into out, or returns false
+static bool fusePair(const decodedInst *a, const decodedInst *b, decodedInst *out)
+{
+	// lui + ori/addiu building one constant, with the same sign-extended
+	// low half the handlers use
+	if (a->op == OP_Lui && a->rt != 0 && (b->op == OP_Ori || b->op == OP_Addi) && b->rs == a->rt && b->rt != 0)
+	{
+		uint32_t upper = (uint32_t)a->imm << 16;
+		*out = *a;
+		out->op = OP_LoadImm;
+		out->rd = a->rt;
+		out->rt = b->rt;
+		out->imm2 = a->imm;
+		out->imm = (b->op == OP_Ori) ? (int32_t)(upper | b->imm) : (int32_t)(upper + b->imm);
+		out->width = 2;
+		out->handler = HANDLERS[OP_LoadImm];
+		return true;
+	}
+
+	// slt/sltu/slti/sltiu + bne/beq on the result against $zero. With
+	// rt = $zero the bne leaves its rt alone, so nothing else changes.
+	uint8_t dest = (a->op == OP_Slt || a->op == OP_Sltu) ? a->rd : a->rt;
+	uint8_t fused = (a->op == OP_Slt) ? OP_SltBranch : (a->op == OP_Sltu) ? OP_SltuBranch : (a->op == OP_Slti) ? OP_SltiBranch : (a->op == OP_Sltiu) ? OP_SltiuBranch : OP_None;
+	if (fused != OP_None && dest != 0 && (b->op == OP_Bne || b->op == OP_Beq) && b->rs == dest && b->rt == 0)
+	{
+		*out = *a;
+		out->op = fused;
+		out->rd = dest;
+		out->shamt = (b->op == OP_Bne) ? 1 : 0;
+		out->imm2 = b->imm;
+		out->width = 2;
+		out->handler = HANDLERS[fused];
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Peephole pass over n records of straight-line code that is only ever
+ * entered at the first one, such as a block. Nops are folded into the
+ * record before them, lui pairs become LoadImm, compare-and-branch
+ * pairs become one op and register moves become Move. Every record
+ * keeps the number of instructions it stands for in width, and state
+ * between records is exactly what the instructions would leave.
+ * Returns the number of records left.
+ */
+uint32_t predecodeOptimize(decodedInst *insts, uint32_t n)
+{
+	uint32_t k, out = 0;
+	decodedInst fused;
+
+	for (k = 0; k < n; k++)
+	{
+		decodedInst *d = &insts[k];
+		if (isNop(d) && out > 0 && canAbsorb(&insts[out - 1]))
+		{
+			insts[out - 1].width += d->width;
+			continue;
+		}
+		if (k + 1 < n && fusePair(d, &insts[k + 1], &fused))
+		{
+			insts[out++] = fused;
+			k++;
+			continue;
+		}
+
+		insts[out] = *d;
+		d = &insts[out++];
+		// Add wraps like addu, so add and or with $zero are plain moves
+		if ((d->op == OP_Add || d->op == OP_Or) && d->rd != 0 && (d->rs == 0 || d->rt == 0))
+		{
+			if (d->rs == 0)
+				d->rs = d->rt;
+			d->op = OP_Move;
+			d->handler = HANDLERS[OP_Move];
+		}
+	}
+	return out;
+}
+
+/*
+ * Decoded pages hang off a two-level table shaped like the guest page
+ * table. The page of the last fetch is remembered, so straight-line
+ * code and loops inside one page skip the walk.
+ */
+static decodedPage **DECODE_TABLE[L1_SIZE];
+static slab DECODE_SLAB;
+static uint32_t LAST_TAG = TLB_INVALID;
+static decodedPage *LAST_PAGE;
+
+// Misaligned PCs are decoded on every fetch and never cached
+static decodedInst MISALIGNED;
+
+static decodedPage *findPage(uint32_t ADDR)
+{
+	decodedPage **table = DECODE_TABLE[L1_INDEX(ADDR)];
+	return (table != NULL) ? table[L2_INDEX(ADDR)] : NULL;
+}
+
+static void invalidatePage(uint32_t ADDR)
+{
+	decodedPage *page = findPage(ADDR);
+	if (page != NULL)
+		memset(page, 0, sizeof(decodedPage));
+}
+
+void predecodeInit()
+{
+	memset(DECODE_TABLE, 0, sizeof(DECODE_TABLE));
+	slabInit(&DECODE_SLAB, sizeof(decodedPage), 16);
+	LAST_TAG = TLB_INVALID;
+	MEM_CODE_WRITE = invalidatePage;
+}
+
+// Drops every decoded page; used when the whole guest is replaced
+void predecodeFlush()
+{
+	uint32_t i;
+	for (i = 0; i < L1_SIZE; i++)
+	{
+		free(DECODE_TABLE[i]);
+		DECODE_TABLE[i] = NULL;
+	}
+	slabRelease(&DECODE_SLAB);
+	memset(MEM_CODE, 0, sizeof(MEM_CODE));
+	LAST_TAG = TLB_INVALID;
+}
+
+decodedInst *predecodeFetch(uint32_t pc)
+{
+	if (pc & 3)
+	{
+		predecode(fetchWord(pc), &MISALIGNED);
+		return &MISALIGNED;
+	}
+
+	decodedPage *page = LAST_PAGE;
+	if (PAGE_NUMBER(pc) != LAST_TAG)
+	{
+		decodedPage **table = DECODE_TABLE[L1_INDEX(pc)];
+		if (table == NULL)
+		{
+			table = (decodedPage **)calloc(L2_SIZE, sizeof(decodedPage *));
+			if (table == NULL)
+			{
+				fprintf(stderr, "ERROR: Out of memory for decoded code at 0x%08x!\n", pc);
+				exit(-1);
+			}
+			DECODE_TABLE[L1_INDEX(pc)] = table;
+		}
+		page = table[L2_INDEX(pc)];
+		if (page == NULL)
+		{
+			page = (decodedPage *)slabAlloc(&DECODE_SLAB);
+			memset(page, 0, sizeof(decodedPage));
+			table[L2_INDEX(pc)] = page;
+		}
+		LAST_TAG = PAGE_NUMBER(pc);
+		LAST_PAGE = page;
+	}
+
+	decodedInst *d = &page->insts[(pc & PAGE_MASK) >> 2];
+	if (d->handler == NULL)
+	{
+		if (!IS_CODE(PAGE_NUMBER(pc)))
+			memMarkCode(pc);
+		predecode(fetchWord(pc), d);
+	}
+	return d;
+}
@@ -0,0 +1,53 @@
+#ifndef PREDECODE_H_
+#define PREDECODE_H_
+
+#include <stdint.h> /* uint32_t */
+
+#include "utils/guest_memory.h"
+
+/*
+ * Predecoded instructions. Each text word is decoded once, the first
+ * time it runs, into a record holding its register fields, the
+ * sign-extended immediate (the raw target for j/jal) and the handler
+ * that executes it. Records live in per-page arrays indexed by
+ * (PC & PAGE_MASK) >> 2. Pages holding records are marked as code, and
+ * the first store to one clears its records so they are decoded again.
+ */
+typedef struct decodedInst decodedInst;
+typedef void (*instHandler)(const decodedInst *d);
+
+// One value per entry of Ops.h, for cores that dispatch on a table
+typedef enum opKind
+{
+#define OP(name, ...) OP_##name,
+#include "Ops.h"
+#undef OP
+	OP_COUNT
+} opKind;
+
+struct decodedInst
+{
+	instHandler handler; /* NULL until the word is decoded */
+	uint8_t op;			 /* opKind of handler */
+	uint8_t rs;
+	uint8_t rt;
+	uint8_t rd;
+	uint8_t shamt;
+	uint8_t width; /* instructions the record stands for */
+	int16_t imm2;  /* second immediate of a fused op */
+	int32_t imm;
+	uint32_t raw;
+};
+
+typedef struct decodedPage
+{
+	decodedInst insts[PAGE_SIZE / 4];
+} decodedPage;
+
+extern void predecodeInit();
+extern void predecodeFlush();
+extern void predecode(uint32_t inst, decodedInst *d);
+extern decodedInst *predecodeFetch(uint32_t pc);
+extern uint32_t predecodeOptimize(decodedInst *insts, uint32_t n);
+
+#endif
@@ -6,6 +6,9 @@
 //32x32 Register File
 int32_t RegFile[34];
 
+//Address of the next instruction to be fetched
+uint32_t ProgramCounter;
+
 void initRegFile(int32_t val) {
     
 	int i;
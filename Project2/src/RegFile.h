@@ -2,6 +2,7 @@
 #define  REG_FILE_H_
 
 extern int32_t RegFile[34];
+extern uint32_t ProgramCounter;
 
 extern void initRegFile(int32_t val);
 extern void printRegFile();
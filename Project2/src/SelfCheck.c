@@ -0,0 +1,291 @@
+#include <stdio.h>	/* printf(), remove() */
+#include <stdint.h>	/* uint32_t */
+#include <stdlib.h>	/* free() */
+
+#include "Log.h"
+#include "RegFile.h"
+#include "Checkpoint.h"
+#include "Snapshot.h"
+#include "elf_reader/elf_reader.h"
+#include "utils/guest_memory.h"
+#include "utils/heap.h"
+
+/*
+ * Host-side regression checks for the emulator's support code, built
+ * and run by 'make check'. Each check sets up guest memory and the
+ * heap the way the loader does and reports every failed expectation.
+ */
+
+static int FAILURES = 0;
+
+#define CHECK(cond)                                                    \
+	do {                                                               \
+		if(!(cond)) {                                                  \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+			FAILURES++;                                                \
+		}                                                              \
+	} while(0)
+
+static void setUp(int heapMode){
+
+	exec.BREAKSTART = 0x80000000;
+	exec.HEAPSTART = 0xC0000000;
+	exec.GSP = 0xf7021fc0;
+	initMemory();
+	initHeap();
+	HEAP_MODE = heapMode;
+
+}
+
+static void tearDown(){
+
+	heapCleanUp();
+	freeMemory();
+
+}
+
+// A realloc too large to round up must fail and leave the block alone
+static void checkReallocOverflow(int heapMode){
+
+	setUp(heapMode);
+	uint32_t a = mm_malloc(16);
+	uint32_t failed = HEAP_STATS.failed;
+	CHECK(a != 0);
+	CHECK(mm_realloc(a, 0xFFFFFFFF) == 0);
+	CHECK(mm_realloc(a, UINT32_MAX - HEAP_ALIGN + 1) == 0);
+	CHECK(mm_realloc(0, 0xFFFFFFFF) == 0);
+	CHECK(HEAP_STATS.failed == failed + 3);
+	CHECK(heapAllocated(a));
+	uint32_t b = mm_malloc(16);
+	CHECK(b != 0 && b != a);
+	mm_free(a);
+	mm_free(b);
+	CHECK(HEAP_STATS.liveBlocks == 0);
+	tearDown();
+
+}
+
+// Shrinking the break discards the pages above it, so growing back
+// over them reads zeros; moves outside the break region are ignored
+static void checkBreak(int heapMode){
+
+	setUp(heapMode);
+	uint32_t start = exec.BREAKSTART;
+	CHECK(mm_brk(0) == start);
+	CHECK(mm_brk(start + 3 * PAGE_SIZE) == start + 3 * PAGE_SIZE);
+	writeWord(start + 16, 0x11111111);
+	writeWord(start + PAGE_SIZE + 8, 0x22222222);
+	writeWord(start + 2 * PAGE_SIZE + 4, 0x33333333);
+
+	CHECK(mm_brk(start + PAGE_SIZE) == start + PAGE_SIZE);
+	CHECK(mm_brk(start + 3 * PAGE_SIZE) == start + 3 * PAGE_SIZE);
+	CHECK(readWord(start + 16) == 0x11111111);
+	CHECK(readWord(start + PAGE_SIZE + 8) == 0);
+	CHECK(readWord(start + 2 * PAGE_SIZE + 4) == 0);
+
+	CHECK(mm_sbrk(-(int32_t)PAGE_SIZE) == start + 2 * PAGE_SIZE);
+	CHECK(mm_sbrk(0) == start + 2 * PAGE_SIZE);
+	CHECK(mm_brk(exec.HEAPSTART) == start + 2 * PAGE_SIZE);
+	CHECK(mm_brk(start - 4) == start + 2 * PAGE_SIZE);
+	tearDown();
+
+}
+
+// calloc hands back zeroed memory even where the block reuses dirty
+// pages, and leaves the neighbours sharing its first and last pages alone
+static void checkCallocZeroes(int heapMode){
+
+	setUp(heapMode);
+	uint32_t size = 3 * PAGE_SIZE + 100;
+	uint32_t before = mm_malloc(64);
+	uint32_t a = mm_malloc(size);
+	uint32_t after = mm_malloc(64);
+	guest_memset(before, 0x11, 64);
+	guest_memset(a, 0xAB, size);
+	guest_memset(after, 0x22, 64);
+	mm_free(a);
+
+	uint32_t c = mm_calloc(1, size);
+	uint32_t addr, nonzero = 0;
+	CHECK(c != 0);
+	for(addr = c; c != 0 && addr < c + size; addr += 4){
+		if(readWord(addr) != 0) nonzero++;
+	}
+	CHECK(nonzero == 0);
+	CHECK(readWord(before + 60) == 0x11111111);
+	CHECK(readWord(after) == 0x22222222);
+	CHECK(mm_calloc(0x10000, 0x10000) == 0);
+
+	mm_free(before);
+	mm_free(c);
+	mm_free(after);
+	tearDown();
+
+}
+
+// The call site recorded for the block at addr, or 0 if there is none
+static uint32_t blockPC(uint32_t addr){
+
+	uint32_t count, i, pc = 0;
+	struct heap_block **blocks = heapSortedBlocks(&count);
+	for(i = 0; i < count; i++){
+		if(blocks[i]->addr == addr && !blocks[i]->free){
+			pc = blocks[i]->pc;
+		}
+	}
+	free(blocks);
+	return pc;
+
+}
+
+// malloc and realloc blame the jal that called them, which leaves
+// PC + 4 in $ra since there is no delay slot
+static void checkAllocationCallSite(int heapMode){
+
+	setUp(heapMode);
+	uint32_t jal = 0x00400100;
+	writeWord(jal, (0x03u << 26) | (0x00400200 >> 2));
+	writeWord(jal + 8, (0x03u << 26) | (0x00400210 >> 2));
+
+	RegFile[31] = jal + 4;
+	uint32_t a = mm_malloc(24);
+	CHECK(blockPC(a) == jal);
+	CHECK((readWord(blockPC(a)) >> 26) == 0x03);
+
+	RegFile[31] = jal + 12;
+	uint32_t b = mm_realloc(a, 40);
+	CHECK(blockPC(b) == jal + 8);
+	CHECK((readWord(blockPC(b)) >> 26) == 0x03);
+
+	mm_free(b);
+	tearDown();
+
+}
+
+// Restoring a snapshot brings back memory, registers and the heap, and
+// leaves the snapshot valid for another restore
+static void checkSnapshotRoundTrip(int heapMode){
+
+	setUp(heapMode);
+	uint32_t a = mm_malloc(64);
+	writeWord(a, 0x11111111);
+	writeWord(0x10010000, 0x22222222);
+	RegFile[8] = 0x33;
+	ProgramCounter = 0x00400020;
+
+	Snapshot *snap = takeSnapshot();
+	CHECK(snap != NULL);
+	if(snap == NULL){
+		tearDown();
+		return;
+	}
+
+	int round;
+	for(round = 0; round < 2; round++){
+		writeWord(a, 0xdeadbeef);
+		writeWord(0x10010000, 0xdeadbeef);
+		writeWord(0x10020000, 0xdeadbeef);
+		uint32_t b = mm_malloc(128);
+		mm_free(a);
+		RegFile[8] = 0;
+		ProgramCounter = 0x00400100;
+
+		restoreSnapshot(snap);
+		CHECK(readWord(a) == 0x11111111);
+		CHECK(readWord(0x10010000) == 0x22222222);
+		CHECK(readWord(0x10020000) == 0);
+		CHECK(RegFile[8] == 0x33);
+		CHECK(ProgramCounter == 0x00400020);
+		CHECK(heapAllocated(a));
+		CHECK(b == 0 || !heapAllocated(b));
+		CHECK(HEAP_STATS.liveBlocks == 1);
+	}
+
+	freeSnapshot(snap);
+	mm_free(a);
+	CHECK(HEAP_STATS.liveBlocks == 0);
+	tearDown();
+
+}
+
+// A base and a delta checkpoint bring back the registers, memory and
+// heap of the later one, including a page discarded in between
+static void checkCheckpointRoundTrip(int heapMode){
+
+	char name[64];
+	uint64_t instructions = 0;
+	int seq;
+
+	setUp(heapMode);
+	CHECKPOINT_SEQ = 0;
+	uint32_t a = mm_malloc(64);
+	writeWord(a, 0x11111111);
+	writeWord(0x10010000, 0x22222222);
+	writeWord(0x10020000, 0x33333333);
+	RegFile[8] = 0x44;
+	ProgramCounter = 0x00400020;
+	CHECK(writeCheckpoint("selfcheck", 100) == 0);
+
+	uint32_t b = mm_malloc(128);
+	writeWord(a, 0x55555555);
+	memDiscard(0x10020000, PAGE_SIZE);
+	RegFile[8] = 0x66;
+	ProgramCounter = 0x00400040;
+	CHECK(writeCheckpoint("selfcheck", 200) == 0);
+
+	writeWord(a, 0xdeadbeef);
+	writeWord(0x10010000, 0xdeadbeef);
+	writeWord(0x10020000, 0xdeadbeef);
+	mm_free(b);
+	RegFile[8] = 0;
+	ProgramCounter = 0;
+
+	CHECK(resumeCheckpoint("selfcheck", &instructions) == 0);
+	CHECK(instructions == 200);
+	CHECK(readWord(a) == 0x55555555);
+	CHECK(readWord(0x10010000) == 0x22222222);
+	CHECK(readWord(0x10020000) == 0);
+	CHECK(RegFile[8] == 0x66);
+	CHECK(ProgramCounter == 0x00400040);
+	CHECK(heapAllocated(a) && heapAllocated(b));
+	CHECK(HEAP_STATS.liveBlocks == 2);
+
+	for(seq = 0; seq < 2; seq++){
+		snprintf(name, sizeof(name), "selfcheck.%d.ckpt", seq);
+		remove(name);
+	}
+	tearDown();
+
+}
+
+int main(){
+
+	int mode;
+
+	LogLevel = LOG_OFF;
+	for(mode = HEAP_MODE_SEGREGATED; mode <= HEAP_MODE_BUDDY; mode++){
+		checkReallocOverflow(mode);
+		checkBreak(mode);
+		checkCallocZeroes(mode);
+		checkAllocationCallSite(mode);
+		checkSnapshotRoundTrip(mode);
+		checkCheckpointRoundTrip(mode);
+	}
+
+	// Discarded pages go back through madvise in the flat backend
+	MEM_BACKEND = MEM_BACKEND_FLAT;
+	for(mode = HEAP_MODE_SEGREGATED; mode <= HEAP_MODE_BUDDY; mode++){
+		checkBreak(mode);
+		checkCallocZeroes(mode);
+		checkCheckpointRoundTrip(mode);
+	}
+	MEM_BACKEND = MEM_BACKEND_PAGED;
+
+	if(FAILURES != 0){
+		printf("%d check(s) failed\n", FAILURES);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+
+}
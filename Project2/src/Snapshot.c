@@ -0,0 +1,49 @@
+#include <stdio.h>	/* fprintf() */
+#include <stdlib.h>	/* malloc() */
+#include <string.h>	/* memcpy() */
+#include <stdint.h>	/* int32_t */
+
+#include "RegFile.h"
+#include "Snapshot.h"
+
+Snapshot *takeSnapshot(){
+
+	Snapshot *snap = (Snapshot *) malloc(sizeof(Snapshot));
+	if(snap == NULL){
+		return NULL;
+	}
+
+	snap->memory = memTakeSnapshot();
+	if(snap->memory == NULL){
+		free(snap);
+		return NULL;
+	}
+
+	memcpy(snap->regFile, RegFile, sizeof(RegFile));
+	snap->programCounter = ProgramCounter;
+	heapSave(&snap->heap);
+
+	return snap;
+
+}
+
+// The snapshot stays valid and can be restored again later
+void restoreSnapshot(const Snapshot *snap){
+
+	memRestoreSnapshot(snap->memory);
+	memcpy(RegFile, snap->regFile, sizeof(RegFile));
+	ProgramCounter = snap->programCounter;
+	heapRestore(&snap->heap);
+
+}
+
+void freeSnapshot(Snapshot *snap){
+
+	if(snap == NULL){
+		return;
+	}
+	memFreeSnapshot(snap->memory);
+	heapStateFree(&snap->heap);
+	free(snap);
+
+}
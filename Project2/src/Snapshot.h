@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h> /* uint32_t */
+
+#include "utils/guest_memory.h"
+#include "utils/heap.h"
+
+/*
+ * A checkpoint of the running guest: registers, program counter,
+ * guest memory and heap bookkeeping. Memory pages are shared
+ * copy-on-write with the live guest, so taking a snapshot costs a
+ * page-table copy and every later write pays for its own page once.
+ */
+typedef struct Snapshot {
+	int32_t regFile[34];
+	uint32_t programCounter;
+	struct memSnapshot *memory;
+	struct heap_state heap;
+} Snapshot;
+
+extern Snapshot *takeSnapshot();
+extern void restoreSnapshot(const Snapshot *snap);
+extern void freeSnapshot(Snapshot *snap);
+
+#endif
@@ -14,12 +14,14 @@
 #include "utils/utarray.h"
 #include "Syscall.h"
 #include "RegFile.h"
+#include "Log.h"
 #include "elf_reader/elf_reader.h"
 
 
 int  FDT_state[10];
 const char *FDT_filename[10];
 int FileDescriptorIndex=0;
+exitHook SYSCALL_EXIT = NULL;
 
 FILE *stdoutF;
 FILE *stderrF;
@@ -58,22 +60,6 @@ void closeFDT() {
 }
 
 
-int hexCharValue(const char ch){
-  if (ch>='0' && ch<='9')return ch-'0';
-  if (ch>='a' && ch<='f')return ch-'a'+10;
-  return 0;
-}
-
-void loadSingleHEX(const char * newValue, int location){
-
-    writeByte((location+0) , ((hexCharValue(newValue[1])) + (hexCharValue(newValue[0])<<4)), false);		//msb
-    writeByte((location+1) , ((hexCharValue(newValue[3])) + (hexCharValue(newValue[2])<<4)), false);
-    writeByte((location+2) , ((hexCharValue(newValue[5])) + (hexCharValue(newValue[4])<<4)), false);
-    writeByte((location+3) , ((hexCharValue(newValue[7])) + (hexCharValue(newValue[6])<<4)), false);		//lsb
-
-
-}
-
 void sm_uname(int sp){
 /*insert into stack...
  * "SescLinux"
@@ -81,52 +67,37 @@ void sm_uname(int sp){
  * "2.4.18"
  * "#1 SMP Tue Jun 4 16:05:29 CDT 2002"
  * "mips"*/
-	printf("running sm_uname\n");
-        loadSingleHEX("6d697073",sp +348);
-        loadSingleHEX("32000000",sp +316);
-        loadSingleHEX("20323030",sp +312);
-        loadSingleHEX("20434454",sp +308);
-        loadSingleHEX("353a3239",sp +304);
-        loadSingleHEX("31363a30",sp +300);
-        loadSingleHEX("6e203420",sp +296);
-        loadSingleHEX("65204a75",sp +292);
-        loadSingleHEX("50205475",sp +288);
-        loadSingleHEX("3120534d",sp +284);
-        loadSingleHEX("00000023",sp +280);
-        loadSingleHEX("342e3138",sp +220);
-        loadSingleHEX("0000322e",sp +216);
-        loadSingleHEX("63000000",sp +156);
-        loadSingleHEX("00736573",sp +152);
-        loadSingleHEX("78000000",sp +96);
-        loadSingleHEX("4c696e75",sp +92);
-        loadSingleHEX("53657363",sp +88);
-        printf("exiting sm_uname\n");
+	// struct utsname at sp+88: five 65 byte fields
+	char utsname[5][65] = {"SescLinux", "sesc", "2.4.18", "#1 SMP Tue Jun 4 16:05:29 CDT 2002", "mips"};
+
+	LOG(LOG_INSTRUCTION, "running sm_uname\n");
+	guest_memcpy_in(sp + 88, utsname, sizeof(utsname));
+	LOG(LOG_INSTRUCTION, "exiting sm_uname\n");
 
 }
 
 
 void fxstat64(int sp)
 {
-        loadSingleHEX("00000009",sp +32);
-        loadSingleHEX("00000000",sp +48);
-        loadSingleHEX("00000002",sp +52);
-        loadSingleHEX("00002190",sp +56);
-        loadSingleHEX("00000001",sp +60);
-        loadSingleHEX("00001fb3",sp +64);
-        loadSingleHEX("00000005",sp +68);
-        loadSingleHEX("00008800",sp +72);
-        loadSingleHEX("00000000",sp +88);
-        loadSingleHEX("00000000",sp +92);
-        loadSingleHEX("00000400",sp +120);
-        loadSingleHEX("00000000",sp +128);
-        loadSingleHEX("00000000",sp +132);
+	// struct stat64 fields as {offset from sp, value}
+	static const uint32_t fields[][2] = {
+		{32, 0x00000009}, {48, 0x00000000}, {52, 0x00000002}, {56, 0x00002190},
+		{60, 0x00000001}, {64, 0x00001fb3}, {68, 0x00000005}, {72, 0x00008800},
+		{88, 0x00000000}, {92, 0x00000000}, {120, 0x00000400}, {128, 0x00000000},
+		{132, 0x00000000}
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(fields) / sizeof(fields[0]); i++){
+		writeWord(sp + fields[i][0], fields[i][1]);
+	}
 }
 
 
 //Syscall Handler 
 void SyscallExe(uint32_t SID) {
 
-	printf("Syscall %d Execution \n",SID);
+	LOG(LOG_INSTRUCTION, "Syscall %d Execution \n",SID);
 
 	switch(SID) {
 		
@@ -134,8 +105,12 @@ void SyscallExe(uint32_t SID) {
 	
 		case 4001:{ 
 				  
-			printf(" ----- Execution Complete -----  \n"); 
-			printf("Program Exiting ");
+			LOG(LOG_SUMMARY, " ----- Execution Complete -----  \n"); 
+			LOG(LOG_SUMMARY, "Program Exiting\n");
+			if(SYSCALL_EXIT != NULL)
+				SYSCALL_EXIT();
+			heapTraceClose();
+			fflush(stdout); // the raw exit skips stdio's own flush
 	
 			syscall(SYS_exit, RegFile[4]);
 	
@@ -144,85 +119,67 @@ void SyscallExe(uint32_t SID) {
 
 		case 4003:{ 
 				  
-			printf("SYSCALL Read File:\n");//read
-			printf("Uninplemented \n");
+			LOG(LOG_INSTRUCTION, "SYSCALL Read File:\n");//read
+			LOG(LOG_INSTRUCTION, "Uninplemented \n");
 			
 			break;  
 		}
 
 		case 4004:{			//write
 	
-			printf("SYSCALL Write File \n"); 
-			printf("File Descriptor Index =  %d",RegFile[4]);
+			LOG(LOG_INSTRUCTION, "SYSCALL Write File \n"); 
+			LOG(LOG_INSTRUCTION, "File Descriptor Index =  %d",RegFile[4]);
 	
 			unsigned int k=RegFile[5];						//start at specified element
 			unsigned int length=RegFile[6];
-	
-			int i = k;
-	
+			char buffer[PAGE_SIZE];
+			unsigned int done = 0;
+
 			if (RegFile[4]!=1 && RegFile[4]!=2) {
 
 				FILE *_file;
 				_file = fopen(FDT_filename[RegFile[4]],"a+" );
-				
-				while (length != 0) {
-					
-					length--; 
-					fprintf(_file,"%c",(char)readByte(i,false));
-					i++;
+
+				while (done < length) {
+
+					unsigned int run = (length - done < sizeof(buffer)) ? length - done : sizeof(buffer);
+					guest_memcpy_out(buffer, k + done, run);
+					fwrite(buffer, 1, run, _file);
+					done += run;
 				}
-				
+
 				fflush(_file);
 				fclose(_file);
-			
+
 			}else{
 
-				while (readByte(i,false)!=00) {
-			
-					length--; 
-					printf("%c",readByte(i,false));
-	
-					if(RegFile[4]==1) {
-	
-						fprintf(stdoutF,"%c", readByte(i,false));
-	
-					} else {
-	
-						fprintf(stderrF,"%c", readByte(i,false));
-	
-					}
-	
-					i++; 
-					
-					if(length == 0){
-						
-						break;
+				// Console output stops at the first NUL; a zero length
+				// means the whole string
+				unsigned int total = guest_strnlen(k, (length == 0) ? UINT32_MAX : length);
+				FILE *_out = (RegFile[4]==1) ? stdoutF : stderrF;
+
+				while (done < total) {
 
-					}
+					unsigned int run = (total - done < sizeof(buffer)) ? total - done : sizeof(buffer);
+					guest_memcpy_out(buffer, k + done, run);
+					fwrite(buffer, 1, run, stdout);
+					fwrite(buffer, 1, run, _out);
+					done += run;
 				}
 
-				if(RegFile[4]==1) {
-	
-					fflush(stdoutF);
-	
-				} else {
-	
-					fflush(stderrF);
-	
-				} 
-	
+				fflush(_out);
+
 			}
-	
-			i++;
-			RegFile[2] = i-k-1;
-	
+
+			RegFile[2] = done;
+
 			break;
 		}
 
 		case 4007:{ 
 				  
-			printf("SYSCALL Write Number to  File \n"); 
-			printf("File Descriptor Index =  1");
+			LOG(LOG_INSTRUCTION, "SYSCALL Write Number to  File \n"); 
+			LOG(LOG_INSTRUCTION, "File Descriptor Index =  1");
 			fprintf(stdoutF,"%d", RegFile[4]);
 			fflush(stdoutF);
 			
@@ -231,34 +188,12 @@ void SyscallExe(uint32_t SID) {
 
 		case 4005:{                                         //open file
 		
-			printf("SYSCALL File Open \n");
-			const char * fIterator = NULL;
-			const char * fName = NULL;
-			uint8_t x;
-			int StrLen = 0;
-			int k = RegFile[4];
-			x = readByte(k,false);
-			while ( x!=0 ) {
-				k++;
-				x = readByte(k,false);
-				StrLen++;
-			}
-
-			fName = (char *) malloc(sizeof(char) * StrLen);
-			fIterator = (char *) malloc(sizeof(char) * StrLen);
-			fName = fIterator;
-
-			k = RegFile[4];
-			x = readByte(k,false);
-		
-			while ( x!=0 ) {
-				fIterator = memset((void *) fIterator,x,1);
-				fIterator++;
-				k++;
-				x = readByte(k,false);
-			}
+			LOG(LOG_INSTRUCTION, "SYSCALL File Open \n");
+			int StrLen = guest_strnlen(RegFile[4], UINT32_MAX);
+			char * fName = (char *) malloc(sizeof(char) * (StrLen + 1));
+			guest_read_cstr(RegFile[4], fName, StrLen + 1);
 
-			printf(" Filename = %s  Index = %d \n",fName,FileDescriptorIndex);
+			LOG(LOG_INSTRUCTION, " Filename = %s  Index = %d \n",fName,FileDescriptorIndex);
 			RegFile[2] = FileDescriptorIndex;
 
 			FILE *_file;
@@ -272,8 +207,8 @@ void SyscallExe(uint32_t SID) {
 
 		case 4006:{
 		
-			printf("SYSCALL File Close \n");
-			printf("File Descriptor Index =  %d",RegFile[4]);
+			LOG(LOG_INSTRUCTION, "SYSCALL File Close \n");
+			LOG(LOG_INSTRUCTION, "File Descriptor Index =  %d",RegFile[4]);
 			FDT_state[RegFile[4]]=0;
 			RegFile[2] = 0 ;
 			break;
@@ -282,7 +217,7 @@ void SyscallExe(uint32_t SID) {
 
 		case 4020:{
 		
-			printf("SYSCALL Getpid \n");
+			LOG(LOG_INSTRUCTION, "SYSCALL Getpid \n");
 			RegFile[2] = syscall(SYS_getpid);
 			
 			break;
@@ -290,64 +225,79 @@ void SyscallExe(uint32_t SID) {
 
 		case 4024:{
 		
-			printf("SYSCALL Getuid \n");
+			LOG(LOG_INSTRUCTION, "SYSCALL Getuid \n");
 			RegFile[2] = syscall(SYS_getuid);
 			break;
 		
 		}
 
-		case 4028:{printf("SYSCALL FStat \n");										
+		case 4028:{LOG(LOG_INSTRUCTION, "SYSCALL FStat \n");										
 		RegFile[4] = RegFile[5];
 		RegFile[5] = RegFile[6];
 		struct stat buf;
 		RegFile[2] = fstat(RegFile[4],&buf);
 		fxstat64(RegFile[29]);
 		break;}
-		case 4047:{printf("SYSCALL Getgid \n");
+		case 4045:{LOG(LOG_INSTRUCTION, "SYSCALL Brk \n");
+		// glibc's __brk traps here itself and keeps __curbrk from the result
+		RegFile[2] = mm_brk(RegFile[4]);
+		LOG(LOG_INSTRUCTION, "Brk: %x\n",RegFile[2]);
+		break;}
+		case 4047:{LOG(LOG_INSTRUCTION, "SYSCALL Getgid \n");
 		RegFile[2] = syscall(SYS_getgid);
 		break;}
 		case 4049 : {
-		printf("SYSCALL Geteuid \n");
+		LOG(LOG_INSTRUCTION, "SYSCALL Geteuid \n");
 		RegFile[2] = syscall(SYS_geteuid);
-		printf(" EUID = %x \n",RegFile[2]);
+		LOG(LOG_INSTRUCTION, " EUID = %x \n",RegFile[2]);
 		break;
 		}                                  
-		case 4050:{printf("SYSCALL Getegid\n");
+		case 4050:{LOG(LOG_INSTRUCTION, "SYSCALL Getegid\n");
 		RegFile[2] = syscall(SYS_getegid);break;}
-		case 4064:{printf("Getppid at time:\n");
+		case 4064:{LOG(LOG_INSTRUCTION, "Getppid at time:\n");
 		RegFile[2] = syscall(SYS_getppid);break;}
-		case 4065:{printf("Getpgrp at time:\n");
+		case 4065:{LOG(LOG_INSTRUCTION, "Getpgrp at time:\n");
 		RegFile[2] = syscall(SYS_getpgrp);break;} 
-		case 4076:{printf("Getrlimit at time:\n");
+		case 4076:{LOG(LOG_INSTRUCTION, "Getrlimit at time:\n");
 		RegFile[2] = syscall(SYS_getrlimit);break;}
-		case 4077:{printf("Getrusage at time:\n");
+		case 4077:{LOG(LOG_INSTRUCTION, "Getrusage at time:\n");
 		RegFile[2] = syscall(SYS_getrusage);break;}
-		case 4078:{printf("GetTimeofDay at time:\n");
+		case 4078:{LOG(LOG_INSTRUCTION, "GetTimeofDay at time:\n");
 		RegFile[2] = syscall(SYS_gettimeofday,NULL,NULL); break;}
-		case 4090:{printf("SYSCALL MMap :\n");
+		case 4090:{LOG(LOG_INSTRUCTION, "SYSCALL MMap :\n");
 		uint32_t size = RegFile[5]*(1+RegFile[4]);
 		if(size < 32) {size = 32;}
 		uint32_t ans = mm_malloc(size);
-		printf("MMap: %x",ans);
+		LOG(LOG_INSTRUCTION, "MMap: %x",ans);
 		RegFile[2] = ans;
 		break;}
-		case 4091:{printf("SYSCALL Munmap ");
+		case 4091:{LOG(LOG_INSTRUCTION, "SYSCALL Munmap ");
 		mm_free(RegFile[4]);
 		break;}
 		case 4122:{
-		printf("SYSCALL Uname \n");
+		LOG(LOG_INSTRUCTION, "SYSCALL Uname \n");
 		sm_uname(RegFile[29]);
 		RegFile[2] = 0;
 		break;}
-		case 4555:{printf("SYSCALL Malloc  \n");
+		case 4555:{LOG(LOG_INSTRUCTION, "SYSCALL Malloc  \n");
 		int size = RegFile[4];
 		if(size < 32){size = 32;}
 		uint32_t ans = mm_malloc(size);
-		printf("MMap: %x Size: %d \n",ans,size);
+		LOG(LOG_INSTRUCTION, "MMap: %x Size: %d \n",ans,size);
+		RegFile[2] = ans;
+		break;}
+		case 4556:{LOG(LOG_INSTRUCTION, "SYSCALL Realloc  \n");
+		uint32_t ans = mm_realloc(RegFile[4],RegFile[5]);
+		LOG(LOG_INSTRUCTION, "Realloc: %x -> %x Size: %d \n",RegFile[4],ans,RegFile[5]);
+		RegFile[2] = ans;
+		break;}
+		case 4557:{LOG(LOG_INSTRUCTION, "SYSCALL Calloc  \n");
+		uint32_t ans = mm_calloc(RegFile[4],RegFile[5]);
+		LOG(LOG_INSTRUCTION, "Calloc: %x Size: %d x %d \n",ans,RegFile[4],RegFile[5]);
 		RegFile[2] = ans;
 		break;}
 
-		default : printf("Syscall Unimplemented"); break;
+		default : LOG(LOG_INSTRUCTION, "Syscall Unimplemented"); break;
 
 	}//switch(SID)
 
@@ -3,7 +3,15 @@
 
 #include <stdint.h> /* uint32_t */
 
+/*
+ * Called by the exit syscall just before the process exits, so the
+ * emulator can print its end-of-run reports: the raw exit never
+ * returns to the main loop. Nothing is called while it is NULL.
+ */
+typedef void (*exitHook)();
+
 extern int FileDescriptorIndex;
+extern exitHook SYSCALL_EXIT;
 
 extern void initFDT();                      
 extern void closeFDT();
@@ -0,0 +1,62 @@
+#include <stdint.h> /* uint32_t */
+#include <stdio.h>	/* printf() */
+#include <stdlib.h> /* exit() */
+
+#include "RegFile.h"
+#include "Syscall.h"
+#include "Execute.h"
+#include "MemReport.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Predecode.h"
+#include "Threaded.h"
+#include "utils/guest_memory.h"
+
+/*
+ * Runs instructions until *count reaches stop or a memory report is
+ * requested, then returns so the main loop can write checkpoints and
+ * reports exactly where the switch core would. *count is kept current
+ * after every instruction because the heap tracer reads it.
+ */
+void runThreaded(uint32_t *count, uint32_t stop)
+{
+	static void *const LABELS[OP_COUNT] = {
+#define OP(name, ...) &&L_##name,
+#include "Ops.h"
+#undef OP
+	};
+	const decodedInst *d;
+
+// Finish the current instruction and jump straight to the next one
+#define DISPATCH()                                     \
+	do                                                 \
+	{                                                  \
+		if (jumpStatus == false)                       \
+			ProgramCounter += 4;                       \
+		if (LOG_ENABLED(LOG_INSTRUCTION))              \
+			traceRetire();                             \
+		if (++*count >= stop || MemReportRequested)    \
+			return;                                    \
+		jumpStatus = false;                            \
+		d = predecodeFetch(ProgramCounter);            \
+		if (LOG_ENABLED(LOG_INSTRUCTION))              \
+			traceInstruction(d->raw);                  \
+		goto *LABELS[d->op];                           \
+	} while (0)
+
+	jumpStatus = false;
+	d = predecodeFetch(ProgramCounter);
+	if (LOG_ENABLED(LOG_INSTRUCTION))
+		traceInstruction(d->raw);
+	goto *LABELS[d->op];
+
+#define OP(name, ...)   \
+	L_##name:           \
+	{                   \
+		__VA_ARGS__     \
+	}                   \
+	DISPATCH();
+#include "Ops.h"
+#undef OP
+#undef DISPATCH
+}
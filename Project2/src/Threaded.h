@@ -0,0 +1,13 @@
+#ifndef THREADED_H_
+#define THREADED_H_
+
+#include <stdint.h> /* uint32_t */
+
+/*
+ * Direct-threaded interpreter core. It runs the predecoded records with
+ * GCC computed goto: every operation ends in its own dispatch jump to
+ * the next record's label instead of returning to one shared switch.
+ */
+extern void runThreaded(uint32_t *count, uint32_t stop);
+
+#endif
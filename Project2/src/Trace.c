@@ -0,0 +1,181 @@
+#include <stdint.h> /* uint32_t */
+#include <stdio.h>	/* sprintf(), fputs(), setvbuf() */
+#include <string.h> /* memcpy() */
+
+#include "RegFile.h"
+#include "Execute.h"
+#include "Log.h"
+#include "Trace.h"
+
+bool DeltaTrace = false;
+
+// Register names as the disassembler and the delta trace print them
+static const char *const REG_NAMES[34] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+	"hi", "lo"};
+
+static const char *const R_NAMES[64] = {
+	[0x00] = "sll", [0x02] = "srl", [0x03] = "sra",
+	[0x04] = "sllv", [0x06] = "srlv", [0x07] = "srav",
+	[0x08] = "jr", [0x09] = "jalr", [0x0C] = "syscall", [0x0D] = "break",
+	[0x10] = "mfhi", [0x11] = "mthi", [0x12] = "mflo", [0x13] = "mtlo",
+	[0x18] = "mult", [0x19] = "multu", [0x1A] = "div", [0x1B] = "divu",
+	[0x20] = "add", [0x21] = "addu", [0x22] = "sub", [0x23] = "subu",
+	[0x24] = "and", [0x25] = "or", [0x26] = "xor", [0x27] = "nor",
+	[0x2A] = "slt", [0x2B] = "sltu",
+};
+
+static const char *const I_NAMES[64] = {
+	[0x02] = "j", [0x03] = "jal",
+	[0x04] = "beq", [0x05] = "bne", [0x06] = "blez", [0x07] = "bgtz",
+	[0x08] = "addi", [0x09] = "addiu", [0x0A] = "slti", [0x0B] = "sltiu",
+	[0x0C] = "andi", [0x0D] = "ori", [0x0E] = "xori", [0x0F] = "lui",
+	[0x20] = "lb", [0x21] = "lh", [0x22] = "lwl", [0x23] = "lw",
+	[0x24] = "lbu", [0x25] = "lhu", [0x26] = "lwr",
+	[0x28] = "sb", [0x29] = "sh", [0x2A] = "swl", [0x2B] = "sw", [0x2E] = "swr",
+};
+
+/*
+ * Writes the assembly of inst, at address pc, to buf (DISASM_MAX bytes).
+ * Branch targets are absolute; jump targets are the raw 26-bit field,
+ * which is where the emulator sends them.
+ */
+void disassemble(uint32_t pc, uint32_t inst, char *buf)
+{
+	uint32_t opcode = (inst >> 26) & 0x3F;
+	const char *rs = REG_NAMES[(inst >> 21) & 0x1F];
+	const char *rt = REG_NAMES[(inst >> 16) & 0x1F];
+	const char *rd = REG_NAMES[(inst >> 11) & 0x1F];
+	uint32_t shamt = (inst >> 6) & 0x1F;
+	int32_t imm = (int16_t)(inst & 0xFFFF);
+	uint32_t target = pc + 4 + ((uint32_t)imm << 2);
+
+	if (opcode == 0x00)
+	{
+		uint32_t funct = inst & 0x3F;
+		const char *name = R_NAMES[funct];
+		if (inst == 0)
+			sprintf(buf, "nop");
+		else if (name == NULL)
+			sprintf(buf, ".word 0x%08x", inst);
+		else if (funct <= 0x03)
+			sprintf(buf, "%s %s,%s,%u", name, rd, rt, shamt);
+		else if (funct <= 0x07)
+			sprintf(buf, "%s %s,%s,%s", name, rd, rt, rs);
+		else if (funct == 0x08 || funct == 0x11 || funct == 0x13)
+			sprintf(buf, "%s %s", name, rs);
+		else if (funct == 0x09)
+			sprintf(buf, "%s %s,%s", name, rd, rs);
+		else if (funct == 0x0C || funct == 0x0D)
+			sprintf(buf, "%s", name);
+		else if (funct == 0x10 || funct == 0x12)
+			sprintf(buf, "%s %s", name, rd);
+		else if (funct <= 0x1B)
+			sprintf(buf, "%s %s,%s", name, rs, rt);
+		else
+			sprintf(buf, "%s %s,%s,%s", name, rd, rs, rt);
+		return;
+	}
+
+	if (opcode == 0x01)
+	{
+		uint32_t kind = (inst >> 16) & 0x1F;
+		const char *name = (kind == 0) ? "bltz" : (kind == 1) ? "bgez" : (kind == 16) ? "bltzal" : (kind == 17) ? "bgezal" : NULL;
+		if (name == NULL)
+			sprintf(buf, ".word 0x%08x", inst);
+		else
+			sprintf(buf, "%s %s,0x%08x", name, rs, target);
+		return;
+	}
+
+	const char *name = I_NAMES[opcode];
+	if (name == NULL)
+		sprintf(buf, ".word 0x%08x", inst);
+	else if (opcode <= 0x03)
+		sprintf(buf, "%s 0x%07x", name, inst & 0x3FFFFFF);
+	else if (opcode <= 0x05)
+		sprintf(buf, "%s %s,%s,0x%08x", name, rs, rt, target);
+	else if (opcode <= 0x07)
+		sprintf(buf, "%s %s,0x%08x", name, rs, target);
+	else if (opcode <= 0x0B)
+		sprintf(buf, "%s %s,%s,%d", name, rt, rs, imm);
+	else if (opcode <= 0x0E)
+		sprintf(buf, "%s %s,%s,0x%x", name, rt, rs, inst & 0xFFFF);
+	else if (opcode == 0x0F)
+		sprintf(buf, "%s %s,0x%x", name, rt, inst & 0xFFFF);
+	else
+		sprintf(buf, "%s %s,%d(%s)", name, rt, imm, rs);
+}
+
+/*
+ * The instruction being traced: its registers before it ran and, for
+ * sb/sh/sw, the store it makes, which is worked out up front from the
+ * same registers the handler reads.
+ */
+static uint32_t TRACE_PC;
+static uint32_t TRACE_INST;
+static int32_t BEFORE[34];
+static uint32_t STORE_ADDR;
+static uint32_t STORE_VALUE;
+static int STORE_DIGITS; /* 0 when the instruction stores nothing */
+
+// Must run before anything is printed, since it rebuffers stdout
+void traceDeltaInit()
+{
+	DeltaTrace = true;
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+}
+
+void traceInstruction(uint32_t inst)
+{
+	if (!DeltaTrace)
+	{
+		printInstruction(inst);
+		return;
+	}
+
+	uint32_t opcode = (inst >> 26) & 0x3F;
+	TRACE_PC = ProgramCounter;
+	TRACE_INST = inst;
+	memcpy(BEFORE, RegFile, sizeof(BEFORE));
+
+	STORE_DIGITS = (opcode == 0x28) ? 2 : (opcode == 0x29) ? 4 : (opcode == 0x2B) ? 8 : 0;
+	if (STORE_DIGITS != 0)
+	{
+		STORE_ADDR = RegFile[(inst >> 21) & 0x1F] + (int16_t)(inst & 0xFFFF);
+		STORE_VALUE = RegFile[(inst >> 16) & 0x1F];
+		if (STORE_DIGITS < 8)
+			STORE_VALUE &= (1u << (4 * STORE_DIGITS)) - 1;
+	}
+}
+
+void traceRetire()
+{
+	if (!DeltaTrace)
+	{
+		if (LOG_ENABLED(LOG_FULL))
+			printRegFile();
+		return;
+	}
+
+	char line[DISASM_MAX + 34 * 16 + 32];
+	char *p = line;
+	int r;
+
+	p += sprintf(p, "%08x %08x ", TRACE_PC, TRACE_INST);
+	disassemble(TRACE_PC, TRACE_INST, p);
+	p += strlen(p);
+	for (r = 1; r < 34; r++)
+	{
+		if (RegFile[r] != BEFORE[r])
+			p += sprintf(p, " %s=%08x", REG_NAMES[r], RegFile[r]);
+	}
+	if (STORE_DIGITS != 0)
+		p += sprintf(p, " [%08x]=%0*x", STORE_ADDR, STORE_DIGITS, STORE_VALUE);
+	*p++ = '\n';
+	*p = '\0';
+	fputs(line, stdout);
+}
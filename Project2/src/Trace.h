@@ -0,0 +1,32 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h> /* uint32_t */
+#include <stdbool.h>
+
+/*
+ * Per-instruction tracing. Every core calls traceInstruction before an
+ * instruction runs and traceRetire after it, both only when
+ * LOG_ENABLED(LOG_INSTRUCTION). By default these print the classic
+ * instruction record and, at full level, a whole register dump.
+ *
+ * With -log delta they print one line per instruction instead:
+ *
+ *   00400024 afbf001c sw ra,28(sp) [7fffeffc]=00400018
+ *
+ * holding the PC, the instruction word, its disassembly and then only
+ * the registers (HI and LO included) the instruction changed and the
+ * memory it stored to. Memory written by syscalls is not listed, and
+ * an exit syscall or break never retires, so it gets no line.
+ */
+extern bool DeltaTrace;
+
+extern void traceDeltaInit();
+extern void traceInstruction(uint32_t inst);
+extern void traceRetire();
+extern void disassemble(uint32_t pc, uint32_t inst, char *buf);
+
+// Large enough for any line disassemble produces
+#define DISASM_MAX 48
+
+#endif
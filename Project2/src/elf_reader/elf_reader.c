@@ -9,6 +9,9 @@
 #include "common.h"
 #include "mips.h"
 #include "elf_reader.h"
+#include "../Log.h"
+#include "../utils/heap.h"
+#include "../utils/arena.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -30,9 +33,11 @@
 
 // global variable
 struct syscall_addresses syscalls;
-struct memElement *MAIN_MEMORY;
 struct execinfo exec;
 
+// fpointer nodes only live while the ELF is parsed
+slab FPOINTER_SLAB;
+
 void writefPointer(char const *fName, uint32_t *fAddr, struct Exe_Format *exFormat, bool DEBUG)
 {
     struct fpointer *m;
@@ -40,16 +45,16 @@ void writefPointer(char const *fName, uint32_t *fAddr, struct Exe_Format *exForm
     HASH_FIND_STR(exFormat->function_pointers, fName, m);
     if (m == NULL)
     {
-        m = (struct fpointer *)malloc(sizeof(struct fpointer));
+        m = (struct fpointer *)slabAlloc(&FPOINTER_SLAB);
         m->fname = fName;
         m->faddr = fAddr;
         HASH_ADD_KEYPTR(hh, exFormat->function_pointers, m->fname, strlen(m->fname), m);
         if (DEBUG)
-            printf("fWRITE : Function = %s Address = %x (%p)\n", fName, *fAddr, fAddr);
+            LOG(LOG_SUMMARY, "fWRITE : Function = %s Address = %x (%p)\n", fName, *fAddr, fAddr);
     }
     else
     {
-        printf(" NOT NEEDED ");
+        LOG(LOG_SUMMARY, " NOT NEEDED ");
     }
 }
 
@@ -60,7 +65,7 @@ struct fpointer *findfPointer(char const *fName, struct Exe_Format *exFormat, bo
     if (DEBUG)
     {
         if (m != NULL)
-            printf("fREAD found          = %s \n", fName);
+            LOG(LOG_SUMMARY, "fREAD found          = %s \n", fName);
     }
     return m;
 }
@@ -72,94 +77,14 @@ uint32_t *readfPointer(char const *fName, struct Exe_Format *exFormat, bool DEBU
     HASH_FIND_STR(exFormat->function_pointers, fName, m);
     if (m == NULL)
     {
-        printf("fREAD Could not find = %s ", fName);
+        LOG(LOG_SUMMARY, "fREAD Could not find = %s ", fName);
         return 0;
     }
     if (DEBUG)
-        printf("fREAD : Function = %s Address = %p \n", m->fname, m->faddr);
+        LOG(LOG_SUMMARY, "fREAD : Function = %s Address = %p \n", m->fname, m->faddr);
     return m->faddr;
 }
 
-void writeByte(uint32_t ADDR, uint8_t DATA, bool DEBUG)
-{
-
-    struct memElement *m;
-
-    HASH_FIND_INT(MAIN_MEMORY, &ADDR, m);
-    if (m == NULL)
-    {
-        m = (struct memElement *)malloc(sizeof(struct memElement));
-        m->addr = ADDR;
-        m->data = DATA;
-        if (DEBUG)
-            printf("WRITE : Address = %x Data = %x \n", ADDR, DATA);
-        HASH_ADD_INT(MAIN_MEMORY, addr, m);
-    }
-    else
-    {
-        struct memElement *dump;
-        m = (struct memElement *)malloc(sizeof(struct memElement));
-        m->addr = ADDR;
-        m->data = DATA;
-        if (DEBUG)
-            printf("WRITE : Address = %x Data = %x \n", ADDR, DATA);
-        HASH_REPLACE_INT(MAIN_MEMORY, addr, m, dump);
-        free(dump);
-    }
-}
-
-uint8_t readByte(uint32_t ADDR, bool DEBUG)
-{
-
-    struct memElement *m;
-    uint8_t temp = 0;
-    HASH_FIND_INT(MAIN_MEMORY, &ADDR, m);
-    if (m == NULL)
-    {
-        temp = 0;
-    }
-    else
-    {
-        temp = m->data;
-    }
-    if (DEBUG)
-        printf("READ : Address = %x Data = %x \n", ADDR, temp);
-    return temp;
-}
-
-void writeWord(uint32_t ADDR, uint32_t DATA, bool DEBUG1)
-{
-    uint8_t temp;
-    bool DEBUG = DEBUG1;
-
-    if (DEBUG1)
-        printf(" WRITE WORD: Addr = %x Data = %x \n", ADDR, DATA);
-    temp = DATA;
-    writeByte(ADDR + 3, temp, DEBUG);
-    temp = DATA >> 8;
-    writeByte(ADDR + 2, temp, DEBUG);
-    temp = DATA >> 16;
-    writeByte(ADDR + 1, temp, DEBUG);
-    temp = DATA >> 24;
-    writeByte(ADDR + 0, temp, DEBUG);
-}
-
-uint32_t readWord(uint32_t ADDR, bool DEBUG)
-{
-    uint32_t temp;
-    bool DEBUG1 = false;
-    temp = readByte(ADDR + 0, DEBUG1);
-    temp = temp << 8;
-    temp = temp | readByte(ADDR + 1, DEBUG1);
-    temp = temp << 8;
-    temp = temp | readByte(ADDR + 2, DEBUG1);
-    temp = temp << 8;
-    temp = temp | readByte(ADDR + 3, DEBUG1);
-    if (DEBUG)
-        printf("READWD : Addr = 0x%08x Data = 0x%08x \n", ADDR, temp);
-    return temp;
-}
-
 void init_syscalls()
 {
     syscalls.CFREE_ADDRESS = 0xFFFFFFF0;
@@ -171,6 +96,8 @@ void init_syscalls()
     syscalls.GETPID_ADDRESS = 0xFFFFFFF0;
     syscalls.GETUID_ADDRESS = 0xFFFFFFF0;
     syscalls.LIBC_MALLOC_ADDRESS = 0xFFFFFFF0;
+    syscalls.LIBC_REALLOC_ADDRESS = 0xFFFFFFF0;
+    syscalls.LIBC_CALLOC_ADDRESS = 0xFFFFFFF0;
     syscalls.LIBC_OPEN_ADDRESS = 0xFFFFFFF0;
     syscalls.LIBC_READ_ADDRESS = 0xFFFFFFF0;
     syscalls.LIBC_WRITE_ADDRESS = 0xFFFFFFF0;
@@ -183,46 +110,45 @@ void init_syscalls()
 
 void fill_syscall(uint32_t address, uint16_t call)
 {
-    printf("Writing syscall %hd at address %x\n", call, address);
-    bool DEBUG1 = false;
-    writeWord(address + 0x0, 0x24020000 | call, DEBUG1); // li $2, call
-    writeWord(address + 0x4, 0xc, DEBUG1);               // syscall
-    writeWord(address + 0x8, 0x03e00008, DEBUG1);        // jr $31
-    writeWord(address + 0xc, 0x0, DEBUG1);               // nop
+    LOG(LOG_SUMMARY, "Writing syscall %hd at address %x\n", call, address);
+    writeWord(address + 0x0, 0x24020000 | call); // li $2, call
+    writeWord(address + 0x4, 0xc);               // syscall
+    writeWord(address + 0x8, 0x03e00008);        // jr $31
+    writeWord(address + 0xc, 0x0);               // nop
 }
 
 void fill_ex_and_add(uint32_t address)
 {
-    printf("Writing Exchange and Add at address %x\n", address);
-    bool DEBUG1 = false;
-    writeWord(address + 0x00, 0x8c820000, DEBUG1); // lw    v0,0(a0)
-    writeWord(address + 0x04, 0x00000000, DEBUG1); // nop
-    writeWord(address + 0x08, 0x00a21821, DEBUG1); // addu  v1,a1,v0
-    writeWord(address + 0x0c, 0xac830000, DEBUG1); // sw    v1,0(a0)
-    writeWord(address + 0x10, 0x03e00008, DEBUG1); // jr    ra
-    writeWord(address + 0x14, 0x24030001, DEBUG1); // li    v1,1
+    LOG(LOG_SUMMARY, "Writing Exchange and Add at address %x\n", address);
+    writeWord(address + 0x00, 0x8c820000); // lw    v0,0(a0)
+    writeWord(address + 0x04, 0x00000000); // nop
+    writeWord(address + 0x08, 0x00a21821); // addu  v1,a1,v0
+    writeWord(address + 0x0c, 0xac830000); // sw    v1,0(a0)
+    writeWord(address + 0x10, 0x03e00008); // jr    ra
+    writeWord(address + 0x14, 0x24030001); // li    v1,1
 }
 
 void fill_atomic_add(uint32_t address)
 {
-    printf("Writing Atomic Add at address %x\n", address);
-    bool DEBUG1 = false;
-    writeWord(address + 0x00, 0x8c820000, DEBUG1); // lw    v0,0(a0)
-    writeWord(address + 0x04, 0x00000000, DEBUG1); // nop
-    writeWord(address + 0x08, 0x00a21021, DEBUG1); // addu  v1,a1,v0
-    writeWord(address + 0x0c, 0xac820000, DEBUG1); // sw    v1,0(a0)
-    writeWord(address + 0x10, 0x03e00008, DEBUG1); // jr    ra
-    writeWord(address + 0x14, 0x24020001, DEBUG1); // li    v0,1
+    LOG(LOG_SUMMARY, "Writing Atomic Add at address %x\n", address);
+    writeWord(address + 0x00, 0x8c820000); // lw    v0,0(a0)
+    writeWord(address + 0x04, 0x00000000); // nop
+    writeWord(address + 0x08, 0x00a21021); // addu  v1,a1,v0
+    writeWord(address + 0x0c, 0xac820000); // sw    v1,0(a0)
+    writeWord(address + 0x10, 0x03e00008); // jr    ra
+    writeWord(address + 0x14, 0x24020001); // li    v0,1
 }
 
 void fill_syscall_redirects()
 {
     bool EMULATE_LLSC = true;
-    printf("\n ----- Redirecting Syscalls ----- \n");
+    LOG(LOG_SUMMARY, "\n ----- Redirecting Syscalls ----- \n");
     fill_syscall(syscalls.CFREE_ADDRESS, 4091);
     fill_syscall(syscalls.EXIT_ADDRESS, 4001);
     fill_syscall(syscalls.FXSTAT64_ADDRESS, 4028);
     fill_syscall(syscalls.LIBC_MALLOC_ADDRESS, 4555);
+    fill_syscall(syscalls.LIBC_REALLOC_ADDRESS, 4556);
+    fill_syscall(syscalls.LIBC_CALLOC_ADDRESS, 4557);
     fill_syscall(syscalls.LIBC_OPEN_ADDRESS, 4005);
     fill_syscall(syscalls.LIBC_READ_ADDRESS, 4003);
     fill_syscall(syscalls.LIBC_WRITE_ADDRESS, 4004);
@@ -244,55 +170,55 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
 
     if (ehdr->e_ident[EI_MAG0] != ELFMAG0 || ehdr->e_ident[EI_MAG1] != ELFMAG1 || ehdr->e_ident[EI_MAG2] != ELFMAG2 || ehdr->e_ident[EI_MAG3] != ELFMAG3)
     {
-        printf("Execution Header Identification Failed \n");
+        fprintf(stderr, "ERROR: Execution Header Identification Failed!\n");
         return -2;
     }
 
     /* Fail if not 32bit */
     if (ehdr->e_ident[EI_CLASS] != ELFCLASS32)
     {
-        printf(" Binary not compiled for 32 bit \n");
+        fprintf(stderr, "ERROR: Binary not compiled for 32 bit!\n");
         return -3;
     }
 
     /* Fail if not BigEndian */
     if (ehdr->e_ident[EI_DATA] != ELFDATA2MSB)
     {
-        printf("Binary Architecture not BigEndian \n");
+        fprintf(stderr, "ERROR: Binary Architecture not BigEndian!\n");
         return -4;
     }
 
     /* Fail if not ELF version 1 */
     if (ehdr->e_ident[EI_VERSION] != 1)
     {
-        printf("Binary is not an ELF File \n");
+        fprintf(stderr, "ERROR: Binary is not an ELF File!\n");
         return -5;
     }
 
     /* Fail if not UNIX System V ABI*/
     if (ehdr->e_ident[EI_OSABI] != ELFOSABI_NONE)
     {
-        printf("Binary not compiled for UNIX system \n");
+        fprintf(stderr, "ERROR: Binary not compiled for UNIX system!\n");
         return -6;
     }
 
     /* Fail if not supported architecture (MIPS) */
     if (bswap_16(ehdr->e_machine) != 8)
     {
-        printf("Binary not compiled for MIPS \n");
+        fprintf(stderr, "ERROR: Binary not compiled for MIPS!\n");
         return -7;
     }
     //  /* Fail if no valid program headers */
     if (bswap_16(ehdr->e_phnum) < 1)
     {
-        printf("No program headers found \n");
+        fprintf(stderr, "ERROR: No program headers found!\n");
         return -8;
     }
     /* Fail if reported ELF header size does not match actual
      * ELF header size */
     if (bswap_16(ehdr->e_ehsize) != sizeof(Elf32_External_Ehdr))
     {
-        printf("ELF execution header size ismatch \n ");
+        fprintf(stderr, "ERROR: ELF execution header size mismatch!\n");
         return -9;
     }
 
@@ -300,7 +226,7 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
      * program header size */
     if (bswap_16(ehdr->e_phentsize) != sizeof(Elf32_External_Phdr))
     {
-        printf("ELF program header size ismatch \n ");
+        fprintf(stderr, "ERROR: ELF program header size mismatch!\n");
         return -10;
     }
     exeFormat->maxUsedAddr = 0;
@@ -330,7 +256,7 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
             exeFormat->segmentList[exeFormat->numSegments].startAddress = bswap_32(phdr->p_vaddr);
             exeFormat->segmentList[exeFormat->numSegments].lengthInFile = bswap_32(phdr->p_filesz);
             exeFormat->segmentList[exeFormat->numSegments].sizeInMemory = bswap_32(phdr->p_memsz);
-            exeFormat->segmentList[exeFormat->numSegments].protFlags = bswap_16(phdr->p_flags);
+            exeFormat->segmentList[exeFormat->numSegments].protFlags = bswap_32(phdr->p_flags);
 
             uint32_t seg_end = exeFormat->segmentList[exeFormat->numSegments].startAddress + exeFormat->segmentList[exeFormat->numSegments].sizeInMemory;
             exeFormat->numSegments++;
@@ -341,7 +267,7 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
         }
         break;
         default:
-            printf("Segment not required \n");
+            LOG(LOG_SUMMARY, "Segment not required \n");
             // Don't bother loading it -- we don't need it.
             // Only known section that would fit this is PAX_FLAGS
             break;
@@ -367,6 +293,7 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
     }
 
     exeFormat->function_pointers = NULL;
+    slabInit(&FPOINTER_SLAB, sizeof(struct fpointer), 64);
 
     char const *temp1;
 
@@ -392,6 +319,10 @@ int parse_elf(const char *elf_data, size_t elf_length, struct Exe_Format *exeFor
     writefPointer(temp1, &syscalls.GETEGID_ADDRESS, exeFormat, false);
     temp1 = "__libc_malloc";
     writefPointer(temp1, &syscalls.LIBC_MALLOC_ADDRESS, exeFormat, false);
+    temp1 = "__libc_realloc";
+    writefPointer(temp1, &syscalls.LIBC_REALLOC_ADDRESS, exeFormat, false);
+    temp1 = "__libc_calloc";
+    writefPointer(temp1, &syscalls.LIBC_CALLOC_ADDRESS, exeFormat, false);
     temp1 = "__cfree";
     writefPointer(temp1, &syscalls.CFREE_ADDRESS, exeFormat, false);
     temp1 = "__fxstat64";
@@ -474,7 +405,7 @@ int LoadOSMemory(const char *file_name)
     if (elf_fd == -1)
     {
 
-        printf("Unable to open Binary");
+        fprintf(stderr, "ERROR: Unable to open Binary!\n");
 
         return -1;
     }
@@ -485,7 +416,7 @@ int LoadOSMemory(const char *file_name)
     if (lstat(file_name, &file_stat))
     {
 
-        printf("Unable to read Binary");
+        fprintf(stderr, "ERROR: Unable to read Binary!\n");
         return -2;
     }
 
@@ -495,13 +426,13 @@ int LoadOSMemory(const char *file_name)
     if (elf_data == MAP_FAILED)
     {
 
-        printf("Unable to allocated required memory");
+        fprintf(stderr, "ERROR: Unable to allocate required memory!\n");
         return -3;
     }
 
     Exe_Format exeFormat;
 
-    MAIN_MEMORY = NULL;
+    initMemory();
 
     init_syscalls();
 
@@ -511,12 +442,12 @@ int LoadOSMemory(const char *file_name)
     {
         munmap(elf_data, file_stat.st_size);
         close(elf_fd);
-        printf("\nERROR READING ELF!!!! (%d)\n", rv);
+        fprintf(stderr, "ERROR: Unable to read ELF (%d)!\n", rv);
         return rv;
     }
 
-    puts("\n-----ELF SUMMARY------\n");
-    printf("Number of required segments %d\n", exeFormat.numSegments);
+    LOG(LOG_SUMMARY, "\n-----ELF SUMMARY------\n\n");
+    LOG(LOG_SUMMARY, "Number of required segments %d\n", exeFormat.numSegments);
 
     int maxAddr = 0;
 
@@ -525,14 +456,24 @@ int LoadOSMemory(const char *file_name)
     {
         // read section into memory
         //  j = offset from start
-        printf("--- Segment %d \n", i);
-        printf("    Type %x\n", exeFormat.segmentList[i].type);
-        printf("    Virtual Start Address 0x%08x\n", exeFormat.segmentList[i].startAddress);
-        printf("    Length in file %d (bytes)\n\n", exeFormat.segmentList[i].lengthInFile);
-        int j;
-        for (j = 0; j < exeFormat.segmentList[i].lengthInFile; j++)
+        LOG(LOG_SUMMARY, "--- Segment %d \n", i);
+        LOG(LOG_SUMMARY, "    Type %x\n", exeFormat.segmentList[i].type);
+        LOG(LOG_SUMMARY, "    Virtual Start Address 0x%08x\n", exeFormat.segmentList[i].startAddress);
+        LOG(LOG_SUMMARY, "    Length in file %d (bytes)\n\n", exeFormat.segmentList[i].lengthInFile);
+        guest_memcpy_in(exeFormat.segmentList[i].startAddress, elf_data + exeFormat.segmentList[i].offsetInFile,
+                        exeFormat.segmentList[i].lengthInFile);
+        // The rest of the segment is BSS: it stays on the zero page
+        // until the program first writes to it.
+        const char *regionName = "note";
+        if (exeFormat.segmentList[i].type == PT_MIPS_REGINFO)
+            regionName = "reginfo";
+        else if (exeFormat.segmentList[i].type == PT_LOAD)
+            regionName = (exeFormat.segmentList[i].protFlags & PF_X) ? "text" : "data";
+        memMapRegion(exeFormat.segmentList[i].startAddress, exeFormat.segmentList[i].lengthInFile, regionName);
+        if (exeFormat.segmentList[i].sizeInMemory > exeFormat.segmentList[i].lengthInFile)
         {
-            writeByte(j + exeFormat.segmentList[i].startAddress, elf_data[j + exeFormat.segmentList[i].offsetInFile], false);
+            memMapRegion(exeFormat.segmentList[i].startAddress + exeFormat.segmentList[i].lengthInFile,
+                         exeFormat.segmentList[i].sizeInMemory - exeFormat.segmentList[i].lengthInFile, "bss");
         }
         if ((exeFormat.segmentList[i].lengthInFile + exeFormat.segmentList[i].startAddress) > maxAddr)
         {
@@ -552,7 +493,16 @@ int LoadOSMemory(const char *file_name)
     exec.GRA = 0x1006a244; // for noio, but we don't really need it
     exec.GP = exeFormat.globalPointer;
 
+    // Reserve the stack below the initial sp, and the startup frame
+    // above it; like BSS it is zero-page backed and only costs host
+    // memory once it is written.
+    memMapRegion((exec.GSP & ~PAGE_MASK) + PAGE_SIZE - STACK_SIZE, STACK_SIZE + STACK_FRAME_SIZE, "stack");
+    memMapRegion(exec.BREAKSTART, exec.HEAPSTART - exec.BREAKSTART, "break");
+    memMapRegion(exec.HEAPSTART, (exec.GSP & ~PAGE_MASK) + PAGE_SIZE - STACK_SIZE - exec.HEAPSTART, "heap");
+
     fill_syscall_redirects();
+    HASH_CLEAR(hh, exeFormat.function_pointers);
+    slabRelease(&FPOINTER_SLAB);
     munmap(elf_data, file_stat.st_size);
     close(elf_fd);
 
@@ -561,7 +511,8 @@ int LoadOSMemory(const char *file_name)
 
 void CleanUp()
 {
-    struct memElement *s, *tmp;
-    HASH_ITER(hh, MAIN_MEMORY, s, tmp) { free(s); }
-    printf("Clean Up Complete \n");
+    memMeasure();
+    freeMemory();
+    heapCleanUp();
+    LOG(LOG_SUMMARY, "Clean Up Complete \n");
 }
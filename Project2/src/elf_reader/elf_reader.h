@@ -10,6 +10,10 @@
  
  #include <stdbool.h>
  #include "../utils/uthash.h"
+ #include "../utils/guest_memory.h"
+ 
+ #define STACK_SIZE 0x800000 /* 8 MB guest stack below exec.GSP */
+ #define STACK_FRAME_SIZE 0x100000 /* 1 MB initial frame (argv, envp, auxv) above it */
  
  typedef struct Exe_Segment {
          uint32_t offsetInFile;  /* Offset of segment in executable file */
@@ -26,12 +30,6 @@
          UT_hash_handle hh;
  } fpointer;
  
- struct memElement {
-         uint32_t addr;
-         uint8_t  data;
-         UT_hash_handle hh;
- };
- 
  typedef struct Exe_Format {
          int      numSegments;
          uint32_t entryAddr;
@@ -62,10 +60,11 @@
          uint32_t GETGID_ADDRESS;
          uint32_t GETEGID_ADDRESS;
          uint32_t LIBC_MALLOC_ADDRESS;
+         uint32_t LIBC_REALLOC_ADDRESS;
+         uint32_t LIBC_CALLOC_ADDRESS;
          uint32_t CFREE_ADDRESS;
          uint32_t FXSTAT64_ADDRESS;
          uint32_t MMAP_ADDRESS;
-         uint32_t BRK_ADDRESS;
          uint32_t LIBC_WRITE_ADDRESS;
          uint32_t CXX_EX_AND_ADD_ADDRESS;
          uint32_t CXX_ATOMIC_ADD_ADDRESS;
@@ -73,8 +72,6 @@
  
  /* Global Variables (extern) */
  extern struct syscall_addresses syscalls;
- extern struct memElement memElement;
- extern struct memElement *MAIN_MEMORY;
  extern struct execinfo exec;
  
  /* Function Declarations */
@@ -82,11 +79,6 @@
  extern uint32_t *readfPointer(const char *fName, struct Exe_Format *exFormat, bool DEBUG);
  extern struct fpointer *findfPointer(const char *fName, struct Exe_Format *exFormat, bool DEBUG);
  
- extern void writeByte(uint32_t ADDR, uint8_t DATA, bool DEBUG);
- extern void writeWord(uint32_t ADDR, uint32_t DATA, bool DEBUG1);
- extern uint8_t readByte(uint32_t ADDR, bool DEBUG);
- extern uint32_t readWord(uint32_t ADDR, bool DEBUG);
- 
  extern void init_syscalls(); 
  extern void fill_syscall(uint32_t address, uint16_t call);
  extern void fill_ex_and_add(uint32_t address);
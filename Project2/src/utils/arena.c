@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+// Objects are 16-byte aligned inside a chunk
+#define SLAB_ALIGN 16
+#define CHUNK_HEADER ((sizeof(slabChunk) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1))
+
+void slabInit(slab *s, size_t objSize, size_t perChunk)
+{
+    if (objSize < sizeof(void *))
+        objSize = sizeof(void *);
+    s->objSize = (objSize + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+    s->perChunk = perChunk;
+    s->freeList = NULL;
+    s->chunks = NULL;
+    s->bump = NULL;
+    s->bumpEnd = NULL;
+    s->live = 0;
+    s->chunkCount = 0;
+    s->huge = false;
+}
+
+void slabInitHuge(slab *s, size_t objSize)
+{
+    slabInit(s, objSize, 1);
+    s->perChunk = (HUGE_PAGE_SIZE - CHUNK_HEADER) / s->objSize;
+    s->huge = true;
+}
+
+// Maps one 2 MB aligned chunk, preferring explicit huge pages
+static void *mapHugeChunk()
+{
+    void *p;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+        return p;
+#endif
+    // Over-map and trim so the chunk starts on a huge page boundary
+    char *raw = (char *)mmap(NULL, 2 * HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned != raw)
+        munmap(raw, aligned - raw);
+    munmap(aligned + HUGE_PAGE_SIZE, raw + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+// Returns a zeroed object
+void *slabAlloc(slab *s)
+{
+    void *obj;
+    if (s->freeList != NULL)
+    {
+        obj = s->freeList;
+        s->freeList = *(void **)obj;
+    }
+    else
+    {
+        if (s->bump == s->bumpEnd)
+        {
+            size_t bytes = CHUNK_HEADER + s->objSize * s->perChunk;
+            slabChunk *chunk = (slabChunk *)(s->huge ? mapHugeChunk() : malloc(bytes));
+            if (chunk == NULL)
+            {
+                fprintf(stderr, "ERROR: Out of host memory for emulator bookkeeping!\n");
+                exit(-1);
+            }
+            chunk->bytes = s->huge ? HUGE_PAGE_SIZE : bytes;
+            chunk->mapped = s->huge;
+            chunk->next = s->chunks;
+            s->chunks = chunk;
+            s->chunkCount++;
+            s->bump = (char *)chunk + CHUNK_HEADER;
+            s->bumpEnd = s->bump + s->objSize * s->perChunk;
+        }
+        obj = s->bump;
+        s->bump += s->objSize;
+    }
+    s->live++;
+    memset(obj, 0, s->objSize);
+    return obj;
+}
+
+void slabFree(slab *s, void *obj)
+{
+    if (obj == NULL)
+        return;
+    *(void **)obj = s->freeList;
+    s->freeList = obj;
+    s->live--;
+}
+
+// Frees every object of the slab at once; the slab can be reused after
+void slabRelease(slab *s)
+{
+    slabChunk *chunk = s->chunks;
+    while (chunk != NULL)
+    {
+        slabChunk *next = chunk->next;
+        if (chunk->mapped)
+            munmap(chunk, chunk->bytes);
+        else
+            free(chunk);
+        chunk = next;
+    }
+    s->freeList = NULL;
+    s->chunks = NULL;
+    s->bump = NULL;
+    s->bumpEnd = NULL;
+    s->live = 0;
+    s->chunkCount = 0;
+}
+
+// True if any chunk of the slab overlaps host range [start, end)
+bool slabOwns(const slab *s, uintptr_t start, uintptr_t end)
+{
+    const slabChunk *chunk;
+    for (chunk = s->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        if ((uintptr_t)chunk < end && (uintptr_t)chunk + chunk->bytes > start)
+            return true;
+    }
+    return false;
+}
+
+// Host bytes held by the slab, live or not
+size_t slabFootprint(const slab *s)
+{
+    return s->chunkCount * (s->huge ? HUGE_PAGE_SIZE : CHUNK_HEADER + s->objSize * s->perChunk);
+}
@@ -0,0 +1,50 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Fixed-size object slabs for the emulator's own bookkeeping nodes
+ * (hash entries, page tables, guest pages). Objects are carved out of
+ * large chunks and recycled through a free list, so allocating or
+ * freeing one is O(1) and slabRelease() tears down every object of a
+ * slab by freeing its chunks, without walking the objects.
+ *
+ * A huge slab takes its chunks as 2 MB aligned mappings, first from
+ * hugetlbfs (MAP_HUGETLB) and otherwise as normal memory advised with
+ * MADV_HUGEPAGE, so the kernel can back them with transparent huge
+ * pages.
+ */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+typedef struct slabChunk
+{
+    struct slabChunk *next;
+    size_t bytes;
+    bool mapped;      /* from mmap (huge slab) rather than malloc */
+} slabChunk;
+
+typedef struct slab
+{
+    size_t objSize;
+    size_t perChunk;
+    void *freeList;
+    slabChunk *chunks;
+    char *bump;       /* next never-used object in the newest chunk */
+    char *bumpEnd;
+    size_t live;      /* objects currently handed out */
+    size_t chunkCount;
+    bool huge;
+} slab;
+
+extern void slabInit(slab *s, size_t objSize, size_t perChunk);
+extern void slabInitHuge(slab *s, size_t objSize);
+extern bool slabOwns(const slab *s, uintptr_t start, uintptr_t end);
+extern void *slabAlloc(slab *s);
+extern void slabFree(slab *s, void *obj);
+extern void slabRelease(slab *s);
+extern size_t slabFootprint(const slab *s);
+
+#endif
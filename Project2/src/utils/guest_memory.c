@@ -0,0 +1,762 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "guest_memory.h"
+#include "arena.h"
+
+// Guest memory is big-endian; convert on every multi-byte access
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GUEST_TO_HOST16(a) (a)
+#define GUEST_TO_HOST32(a) (a)
+#else
+#define GUEST_TO_HOST16(a) __builtin_bswap16(a)
+#define GUEST_TO_HOST32(a) __builtin_bswap32(a)
+#endif
+
+// global variable
+pageTable *PAGE_TABLE[L1_SIZE];
+uint32_t PAGES_RESIDENT;
+uint8_t ZERO_PAGE[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+memRegion MEM_REGIONS[MAX_REGIONS];
+int MEM_REGION_COUNT;
+tlbEntry TLB_READ[TLB_SIZE];
+tlbEntry TLB_WRITE[TLB_SIZE];
+tlbEntry TLB_FETCH[TLB_SIZE];
+int MEM_BACKEND = MEM_BACKEND_PAGED;
+uint8_t *MEM_BASE = NULL;
+uint32_t MEM_DIRTY[DIRTY_WORDS];
+bool MEM_DIRTY_ALL;
+uint32_t MEM_CODE[DIRTY_WORDS];
+// Flat backend pages written since they were last discarded, kept apart
+// from MEM_DIRTY so a full checkpoint does not depend on residency
+static uint32_t MEM_WRITTEN[DIRTY_WORDS];
+codeWriteHook MEM_CODE_WRITE = NULL;
+bool MEM_HUGEPAGES = false;
+size_t MEM_RESIDENT_BYTES;
+size_t MEM_HOST_BYTES;
+size_t MEM_HUGE_BYTES;
+
+// All pages and second-level tables come from these two slabs
+static slab PAGE_SLAB;
+static slab TABLE_SLAB;
+
+void initMemory()
+{
+    memset(PAGE_TABLE, 0, sizeof(PAGE_TABLE));
+    PAGES_RESIDENT = 0;
+    MEM_REGION_COUNT = 0;
+    MEM_BASE = NULL;
+    memset(MEM_DIRTY, 0, sizeof(MEM_DIRTY));
+    MEM_DIRTY_ALL = false;
+    memset(MEM_CODE, 0, sizeof(MEM_CODE));
+    memset(MEM_WRITTEN, 0, sizeof(MEM_WRITTEN));
+    if (MEM_HUGEPAGES)
+        slabInitHuge(&PAGE_SLAB, sizeof(guestPage));
+    else
+        slabInit(&PAGE_SLAB, sizeof(guestPage), 256);
+    slabInit(&TABLE_SLAB, sizeof(pageTable), 16);
+    tlbFlush();
+
+    if (MEM_BACKEND == MEM_BACKEND_FLAT)
+    {
+        // One extra page so a word access at the top of the address
+        // space never runs off the end of the mapping.
+        void *base = mmap(NULL, FLAT_MAP_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            fprintf(stderr, "WARNING: Unable to reserve flat guest address space, using paged memory\n");
+            MEM_BACKEND = MEM_BACKEND_PAGED;
+        }
+        else
+            MEM_BASE = (uint8_t *)base;
+#ifdef MADV_HUGEPAGE
+        // Explicit hugetlbfs pages cannot back a NORESERVE reservation
+        // safely, so the flat backend only asks for transparent ones.
+        if (MEM_BASE != NULL && MEM_HUGEPAGES)
+            madvise(MEM_BASE, FLAT_MAP_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+}
+
+void memMapRegion(uint32_t start, uint32_t size, const char *name)
+{
+    if (size == 0 || MEM_REGION_COUNT == MAX_REGIONS)
+        return;
+    MEM_REGIONS[MEM_REGION_COUNT].start = start;
+    MEM_REGIONS[MEM_REGION_COUNT].end = start + size;
+    MEM_REGIONS[MEM_REGION_COUNT].name = name;
+    MEM_REGION_COUNT++;
+}
+
+// Drop every cached translation. Must be called whenever pages are
+// freed or the page table is swapped out from under the TLBs.
+void tlbFlush()
+{
+    uint32_t i;
+    for (i = 0; i < TLB_SIZE; i++)
+    {
+        TLB_READ[i].tag = TLB_INVALID;
+        TLB_WRITE[i].tag = TLB_INVALID;
+        TLB_FETCH[i].tag = TLB_INVALID;
+    }
+}
+
+void tlbFlushPage(uint32_t ADDR)
+{
+    uint32_t index = TLB_INDEX(ADDR);
+    if (TLB_READ[index].tag == PAGE_NUMBER(ADDR))
+        TLB_READ[index].tag = TLB_INVALID;
+    if (TLB_WRITE[index].tag == PAGE_NUMBER(ADDR))
+        TLB_WRITE[index].tag = TLB_INVALID;
+    if (TLB_FETCH[index].tag == PAGE_NUMBER(ADDR))
+        TLB_FETCH[index].tag = TLB_INVALID;
+}
+
+// Translate through TLB, walking the page table on a miss. Pages that
+// were never written translate to ZERO_PAGE until their first store.
+static inline uint8_t *tlbLookup(tlbEntry *tlb, uint32_t ADDR)
+{
+    if (MEM_BASE != NULL)
+        return MEM_BASE + (ADDR & ~PAGE_MASK);
+
+    tlbEntry *e = &tlb[TLB_INDEX(ADDR)];
+    if (e->tag == PAGE_NUMBER(ADDR))
+        return e->page;
+
+    uint8_t *page = memPageLookup(ADDR);
+    e->tag = PAGE_NUMBER(ADDR);
+    e->page = (page != NULL) ? page : ZERO_PAGE;
+    return e->page;
+}
+
+// A store is about to change a page something decoded code from
+static void codeWritten(uint32_t ADDR)
+{
+    MEM_CODE[PAGE_NUMBER(ADDR) >> 5] &= ~(1u << (PAGE_NUMBER(ADDR) & 31));
+    if (MEM_CODE_WRITE != NULL)
+        MEM_CODE_WRITE(ADDR & ~PAGE_MASK);
+}
+
+static inline uint8_t *tlbLookupWrite(uint32_t ADDR)
+{
+    if (MEM_BASE != NULL)
+    {
+        MARK_DIRTY(ADDR);
+        MEM_WRITTEN[PAGE_NUMBER(ADDR) >> 5] |= 1u << (PAGE_NUMBER(ADDR) & 31);
+        if (IS_CODE(PAGE_NUMBER(ADDR)))
+            codeWritten(ADDR);
+        return MEM_BASE + (ADDR & ~PAGE_MASK);
+    }
+
+    tlbEntry *e = &TLB_WRITE[TLB_INDEX(ADDR)];
+    if (e->tag == PAGE_NUMBER(ADDR))
+        return e->page;
+
+    MARK_DIRTY(ADDR);
+    e->page = memPageAlloc(ADDR);
+    e->tag = PAGE_NUMBER(ADDR);
+    return e->page;
+}
+
+static guestPage *newPage()
+{
+    guestPage *page = (guestPage *)slabAlloc(&PAGE_SLAB);
+    page->refs = 1;
+    PAGES_RESIDENT++;
+    return page;
+}
+
+static void releasePage(guestPage *page)
+{
+    if (page != NULL && --page->refs == 0)
+    {
+        slabFree(&PAGE_SLAB, page);
+        PAGES_RESIDENT--;
+    }
+}
+
+static pageTable *newTable()
+{
+    pageTable *table = (pageTable *)slabAlloc(&TABLE_SLAB);
+    table->refs = 1;
+    return table;
+}
+
+static void releaseTable(pageTable *table)
+{
+    uint32_t j;
+    if (table == NULL || --table->refs != 0)
+        return;
+    for (j = 0; j < L2_SIZE; j++)
+    {
+        releasePage(table->pages[j]);
+    }
+    slabFree(&TABLE_SLAB, table);
+}
+
+// Tears down all guest memory in O(chunks) by releasing the slabs
+// instead of walking the page table. Outstanding snapshots share those
+// pages, so they must not be used afterwards.
+void freeMemory()
+{
+    if (MEM_BASE != NULL)
+    {
+        munmap(MEM_BASE, FLAT_MAP_SIZE);
+        MEM_BASE = NULL;
+    }
+    memset(PAGE_TABLE, 0, sizeof(PAGE_TABLE));
+    slabRelease(&PAGE_SLAB);
+    slabRelease(&TABLE_SLAB);
+    PAGES_RESIDENT = 0;
+    tlbFlush();
+}
+
+// Returns the host page backing ADDR, or NULL if it was never written
+uint8_t *memPageLookup(uint32_t ADDR)
+{
+    if (MEM_BASE != NULL)
+        return MEM_BASE + (ADDR & ~PAGE_MASK);
+
+    pageTable *table = PAGE_TABLE[L1_INDEX(ADDR)];
+    if (table == NULL || table->pages[L2_INDEX(ADDR)] == NULL)
+        return NULL;
+    return table->pages[L2_INDEX(ADDR)]->data;
+}
+
+// Returns the second-level table for ADDR, copied first if it is still
+// shared with a snapshot. With create a missing table is allocated,
+// otherwise NULL is returned for it.
+static pageTable *ownTable(uint32_t ADDR, bool create)
+{
+    pageTable *table = PAGE_TABLE[L1_INDEX(ADDR)];
+    if (table == NULL)
+    {
+        if (!create)
+            return NULL;
+        table = newTable();
+        PAGE_TABLE[L1_INDEX(ADDR)] = table;
+    }
+    else if (table->refs > 1)
+    {
+        uint32_t j;
+        pageTable *copy = newTable();
+        for (j = 0; j < L2_SIZE; j++)
+        {
+            copy->pages[j] = table->pages[j];
+            if (copy->pages[j] != NULL)
+                copy->pages[j]->refs++;
+        }
+        table->refs--;
+        table = copy;
+        PAGE_TABLE[L1_INDEX(ADDR)] = table;
+    }
+    return table;
+}
+
+// Returns a host page backing ADDR that is safe to write, allocating a
+// zeroed one if needed. Tables and pages still shared with a snapshot
+// are copied first, so a snapshot only ever pays for the pages that
+// are written after it was taken.
+uint8_t *memPageAlloc(uint32_t ADDR)
+{
+    if (IS_CODE(PAGE_NUMBER(ADDR)))
+        codeWritten(ADDR);
+    if (MEM_BASE != NULL)
+    {
+        MEM_WRITTEN[PAGE_NUMBER(ADDR) >> 5] |= 1u << (PAGE_NUMBER(ADDR) & 31);
+        return MEM_BASE + (ADDR & ~PAGE_MASK);
+    }
+
+    pageTable *table = ownTable(ADDR, true);
+
+    guestPage *page = table->pages[L2_INDEX(ADDR)];
+    if (page == NULL)
+    {
+        page = newPage();
+        table->pages[L2_INDEX(ADDR)] = page;
+        // Read and fetch translations may still point at ZERO_PAGE
+        tlbFlushPage(ADDR);
+    }
+    else if (page->refs > 1)
+    {
+        guestPage *copy = newPage();
+        memcpy(copy->data, page->data, PAGE_SIZE);
+        page->refs--;
+        page = copy;
+        table->pages[L2_INDEX(ADDR)] = page;
+        // Read and fetch translations still point at the shared copy
+        tlbFlushPage(ADDR);
+    }
+    return page->data;
+}
+
+// Gives the pages lying wholly inside [ADDR, ADDR+len) back, so they
+// read as zero again and no longer cost host memory. The pages are
+// marked dirty so the next delta checkpoint records them as zeroed.
+void memDiscard(uint32_t ADDR, uint32_t len)
+{
+    uint64_t start = ((uint64_t)ADDR + PAGE_MASK) & ~(uint64_t)PAGE_MASK;
+    uint64_t end = ((uint64_t)ADDR + len) & ~(uint64_t)PAGE_MASK;
+    uint64_t addr;
+    if (start >= end)
+        return;
+    for (addr = start; addr < end; addr += PAGE_SIZE)
+    {
+        MARK_DIRTY(addr);
+        tlbFlushPage(addr);
+        if (IS_CODE(PAGE_NUMBER(addr)))
+            codeWritten(addr);
+        if (MEM_BASE != NULL)
+            MEM_WRITTEN[PAGE_NUMBER(addr) >> 5] &= ~(1u << (PAGE_NUMBER(addr) & 31));
+        if (MEM_BASE != NULL || PAGE_TABLE[L1_INDEX(addr)] == NULL)
+            continue;
+        pageTable *table = ownTable(addr, false);
+        releasePage(table->pages[L2_INDEX(addr)]);
+        table->pages[L2_INDEX(addr)] = NULL;
+    }
+    if (MEM_BASE != NULL)
+        madvise(MEM_BASE + start, end - start, MADV_DONTNEED);
+}
+
+// Captures the page table by sharing every second-level table with the
+// live one. This is O(L1_SIZE); the pages themselves are only copied
+// when the guest next writes them.
+memSnapshot *memTakeSnapshot()
+{
+    uint32_t i;
+    if (MEM_BASE != NULL)
+    {
+        fprintf(stderr, "ERROR: Snapshots require the paged memory backend!\n");
+        return NULL;
+    }
+
+    memSnapshot *snap = (memSnapshot *)malloc(sizeof(memSnapshot));
+    if (snap == NULL)
+        return NULL;
+    for (i = 0; i < L1_SIZE; i++)
+    {
+        snap->tables[i] = PAGE_TABLE[i];
+        if (PAGE_TABLE[i] != NULL)
+            PAGE_TABLE[i]->refs++;
+    }
+
+    // Every cached write translation may now point at a shared page
+    for (i = 0; i < TLB_SIZE; i++)
+    {
+        TLB_WRITE[i].tag = TLB_INVALID;
+    }
+    return snap;
+}
+
+void memRestoreSnapshot(const memSnapshot *snap)
+{
+    uint32_t i;
+    for (i = 0; i < L1_SIZE; i++)
+    {
+        if (snap->tables[i] != NULL)
+            snap->tables[i]->refs++;
+        releaseTable(PAGE_TABLE[i]);
+        PAGE_TABLE[i] = snap->tables[i];
+    }
+    MEM_DIRTY_ALL = true;
+    tlbFlush();
+
+    // Every code page may have changed under its decoded copy
+    for (i = 0; i < PAGE_COUNT; i++)
+    {
+        if (MEM_CODE[i >> 5] == 0)
+            i |= 31;
+        else if (IS_CODE(i))
+            codeWritten(i << PAGE_BITS);
+    }
+}
+
+void memFreeSnapshot(memSnapshot *snap)
+{
+    uint32_t i;
+    if (snap == NULL)
+        return;
+    for (i = 0; i < L1_SIZE; i++)
+    {
+        releaseTable(snap->tables[i]);
+    }
+    free(snap);
+}
+
+void writeByte(uint32_t ADDR, uint8_t DATA)
+{
+    tlbLookupWrite(ADDR)[ADDR & PAGE_MASK] = DATA;
+#ifdef MEM_TRACE
+    printf("WRITE : Address = %x Data = %x \n", ADDR, DATA);
+#endif
+}
+
+uint8_t readByte(uint32_t ADDR)
+{
+    uint8_t temp = tlbLookup(TLB_READ, ADDR)[ADDR & PAGE_MASK];
+#ifdef MEM_TRACE
+    printf("READ : Address = %x Data = %x \n", ADDR, temp);
+#endif
+    return temp;
+}
+
+// Halfwords and words are read with a single host load plus a byteswap
+// when the access stays inside one page; only accesses straddling a
+// page boundary fall back to per-byte assembly.
+uint16_t readHalf(uint32_t ADDR)
+{
+    uint16_t temp;
+    if ((ADDR & PAGE_MASK) <= PAGE_SIZE - 2)
+    {
+        memcpy(&temp, tlbLookup(TLB_READ, ADDR) + (ADDR & PAGE_MASK), 2);
+        temp = GUEST_TO_HOST16(temp);
+    }
+    else
+        temp = ((uint16_t)readByte(ADDR) << 8) | readByte(ADDR + 1);
+#ifdef MEM_TRACE
+    printf("READHF : Addr = 0x%08x Data = 0x%04x \n", ADDR, temp);
+#endif
+    return temp;
+}
+
+void writeHalf(uint32_t ADDR, uint16_t DATA)
+{
+#ifdef MEM_TRACE
+    printf(" WRITE HALF: Addr = %x Data = %x \n", ADDR, DATA);
+#endif
+    if ((ADDR & PAGE_MASK) <= PAGE_SIZE - 2)
+    {
+        uint16_t temp = GUEST_TO_HOST16(DATA);
+        memcpy(tlbLookupWrite(ADDR) + (ADDR & PAGE_MASK), &temp, 2);
+    }
+    else
+    {
+        writeByte(ADDR, DATA >> 8);
+        writeByte(ADDR + 1, DATA);
+    }
+}
+
+void writeWord(uint32_t ADDR, uint32_t DATA)
+{
+#ifdef MEM_TRACE
+    printf(" WRITE WORD: Addr = %x Data = %x \n", ADDR, DATA);
+#endif
+    if ((ADDR & PAGE_MASK) <= PAGE_SIZE - 4)
+    {
+        uint32_t temp = GUEST_TO_HOST32(DATA);
+        memcpy(tlbLookupWrite(ADDR) + (ADDR & PAGE_MASK), &temp, 4);
+    }
+    else
+    {
+        writeByte(ADDR + 0, DATA >> 24);
+        writeByte(ADDR + 1, DATA >> 16);
+        writeByte(ADDR + 2, DATA >> 8);
+        writeByte(ADDR + 3, DATA);
+    }
+}
+
+uint32_t readWord(uint32_t ADDR)
+{
+    uint32_t temp;
+    if ((ADDR & PAGE_MASK) <= PAGE_SIZE - 4)
+    {
+        memcpy(&temp, tlbLookup(TLB_READ, ADDR) + (ADDR & PAGE_MASK), 4);
+        temp = GUEST_TO_HOST32(temp);
+    }
+    else
+    {
+        temp = readByte(ADDR + 0);
+        temp = temp << 8;
+        temp = temp | readByte(ADDR + 1);
+        temp = temp << 8;
+        temp = temp | readByte(ADDR + 2);
+        temp = temp << 8;
+        temp = temp | readByte(ADDR + 3);
+    }
+#ifdef MEM_TRACE
+    printf("READWD : Addr = 0x%08x Data = 0x%08x \n", ADDR, temp);
+#endif
+    return temp;
+}
+
+// Instruction fetch goes through its own TLB so data traffic in the
+// loop body does not evict the translation of the code page.
+uint32_t fetchWord(uint32_t ADDR)
+{
+    if ((ADDR & PAGE_MASK) > PAGE_SIZE - 4)
+        return readWord(ADDR);
+
+    uint32_t temp;
+    memcpy(&temp, tlbLookup(TLB_FETCH, ADDR) + (ADDR & PAGE_MASK), 4);
+    return GUEST_TO_HOST32(temp);
+}
+
+// Start a new dirty interval. Write translations are dropped so the
+// next store to every page goes through the slow path and marks it.
+void memClearDirty()
+{
+    uint32_t i;
+    memset(MEM_DIRTY, 0, sizeof(MEM_DIRTY));
+    MEM_DIRTY_ALL = false;
+    for (i = 0; i < TLB_SIZE; i++)
+    {
+        TLB_WRITE[i].tag = TLB_INVALID;
+    }
+}
+
+// Records that ADDR's page has been decoded. Its write translation is
+// dropped so the next store to it reaches codeWritten.
+void memMarkCode(uint32_t ADDR)
+{
+    MEM_CODE[PAGE_NUMBER(ADDR) >> 5] |= 1u << (PAGE_NUMBER(ADDR) & 31);
+    tlbEntry *e = &TLB_WRITE[TLB_INDEX(ADDR)];
+    if (e->tag == PAGE_NUMBER(ADDR))
+        e->tag = TLB_INVALID;
+}
+
+// Calls visit for every page set in bits, in ascending address order
+static void visitPages(const uint32_t *bits, pageVisitor visit, void *ctx)
+{
+    uint32_t i, j;
+    for (i = 0; i < DIRTY_WORDS; i++)
+    {
+        if (bits[i] == 0)
+            continue;
+        for (j = 0; j < 32; j++)
+        {
+            uint32_t addr = (i * 32 + j) << PAGE_BITS;
+            if ((bits[i] >> j) & 1)
+                visit(addr, memPageLookup(addr), ctx);
+        }
+    }
+}
+
+// Calls visit for every resident page (or only the dirty ones) in
+// ascending address order. The flat backend visits every page written
+// since it was last discarded; asking the kernel which pages are
+// resident would miss any it has swapped out.
+// Dirty pages that were discarded are visited with NULL data in the
+// paged backend; the flat backend passes the (zero) page itself.
+void memForEachPage(bool dirtyOnly, pageVisitor visit, void *ctx)
+{
+    uint32_t i, j;
+    if (dirtyOnly)
+    {
+        visitPages(MEM_DIRTY, visit, ctx);
+        return;
+    }
+
+    if (MEM_BASE != NULL)
+    {
+        visitPages(MEM_WRITTEN, visit, ctx);
+        return;
+    }
+
+    for (i = 0; i < L1_SIZE; i++)
+    {
+        if (PAGE_TABLE[i] == NULL)
+            continue;
+        for (j = 0; j < L2_SIZE; j++)
+        {
+            if (PAGE_TABLE[i]->pages[j] != NULL)
+                visit((i << (PAGE_BITS + L2_BITS)) | (j << PAGE_BITS), PAGE_TABLE[i]->pages[j]->data, ctx);
+        }
+    }
+}
+
+// Bulk copies move whole page runs with memcpy instead of going
+// through the byte accessors one address at a time.
+void guest_memcpy_in(uint32_t dst, const void *src, uint32_t len)
+{
+    const uint8_t *from = (const uint8_t *)src;
+    while (len > 0)
+    {
+        uint32_t run = PAGE_SIZE - (dst & PAGE_MASK);
+        if (run > len)
+            run = len;
+        memcpy(tlbLookupWrite(dst) + (dst & PAGE_MASK), from, run);
+        dst += run;
+        from += run;
+        len -= run;
+    }
+}
+
+void guest_memcpy_out(void *dst, uint32_t src, uint32_t len)
+{
+    uint8_t *to = (uint8_t *)dst;
+    while (len > 0)
+    {
+        uint32_t run = PAGE_SIZE - (src & PAGE_MASK);
+        if (run > len)
+            run = len;
+        memcpy(to, tlbLookup(TLB_READ, src) + (src & PAGE_MASK), run);
+        src += run;
+        to += run;
+        len -= run;
+    }
+}
+
+// Copies len guest bytes from src to dst; the ranges may overlap. The
+// destination page is looked up first so a copy-on-write triggered by
+// it is seen by the source lookup when both lie in the same page.
+void guest_memmove(uint32_t dst, uint32_t src, uint32_t len)
+{
+    if (dst == src)
+        return;
+    if (dst < src || dst - src >= len)
+    {
+        while (len > 0)
+        {
+            uint32_t run = PAGE_SIZE - (dst & PAGE_MASK);
+            if (run > PAGE_SIZE - (src & PAGE_MASK))
+                run = PAGE_SIZE - (src & PAGE_MASK);
+            if (run > len)
+                run = len;
+            uint8_t *to = tlbLookupWrite(dst) + (dst & PAGE_MASK);
+            memmove(to, tlbLookup(TLB_READ, src) + (src & PAGE_MASK), run);
+            dst += run;
+            src += run;
+            len -= run;
+        }
+        return;
+    }
+    // dst overlaps the tail of src, copy from the end backwards
+    while (len > 0)
+    {
+        uint32_t dstLast = dst + len - 1;
+        uint32_t srcLast = src + len - 1;
+        uint32_t run = (dstLast & PAGE_MASK) + 1;
+        if (run > (srcLast & PAGE_MASK) + 1)
+            run = (srcLast & PAGE_MASK) + 1;
+        if (run > len)
+            run = len;
+        len -= run;
+        uint8_t *to = tlbLookupWrite(dst + len) + ((dst + len) & PAGE_MASK);
+        memmove(to, tlbLookup(TLB_READ, src + len) + ((src + len) & PAGE_MASK), run);
+    }
+}
+
+void guest_memset(uint32_t dst, uint8_t value, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t run = PAGE_SIZE - (dst & PAGE_MASK);
+        if (run > len)
+            run = len;
+        memset(tlbLookupWrite(dst) + (dst & PAGE_MASK), value, run);
+        dst += run;
+        len -= run;
+    }
+}
+
+// Length of the NUL-terminated guest string at src, at most max
+uint32_t guest_strnlen(uint32_t src, uint32_t max)
+{
+    uint32_t len = 0;
+    while (len < max)
+    {
+        uint32_t run = PAGE_SIZE - (src & PAGE_MASK);
+        if (run > max - len)
+            run = max - len;
+        const uint8_t *p = tlbLookup(TLB_READ, src) + (src & PAGE_MASK);
+        const uint8_t *nul = (const uint8_t *)memchr(p, 0, run);
+        if (nul != NULL)
+            return len + (uint32_t)(nul - p);
+        src += run;
+        len += run;
+    }
+    return max;
+}
+
+// Copies a guest string into dst (always terminated, truncated to
+// size - 1 characters) and returns its length
+uint32_t guest_read_cstr(uint32_t src, char *dst, uint32_t size)
+{
+    if (size == 0)
+        return 0;
+    uint32_t len = guest_strnlen(src, size - 1);
+    guest_memcpy_out(dst, src, len);
+    dst[len] = '\0';
+    return len;
+}
+
+static void countPage(uint32_t ADDR, const uint8_t *data, void *ctx)
+{
+    (void)ADDR;
+    (void)data;
+    *(size_t *)ctx += PAGE_SIZE;
+}
+
+// Host bytes spent on second-level page tables
+size_t memMetadataBytes()
+{
+    return slabFootprint(&TABLE_SLAB);
+}
+
+// Host bytes held by the page slab beyond the resident pages' data:
+// per-page headers and not yet used or freed frames
+size_t memFrameOverheadBytes()
+{
+    return slabFootprint(&PAGE_SLAB) - (size_t)PAGES_RESIDENT * PAGE_SIZE;
+}
+
+// Host bytes of guest RAM currently resident
+size_t memResidentBytes()
+{
+    size_t bytes = 0;
+    if (MEM_BASE == NULL)
+        return (size_t)PAGES_RESIDENT * PAGE_SIZE;
+    memForEachPage(false, countPage, &bytes);
+    return bytes;
+}
+
+static bool ownsHostRange(uintptr_t start, uintptr_t end)
+{
+    if (MEM_BASE != NULL)
+        return start < (uintptr_t)MEM_BASE + FLAT_MAP_SIZE && end > (uintptr_t)MEM_BASE;
+    return slabOwns(&PAGE_SLAB, start, end);
+}
+
+// Host bytes of guest RAM backed by huge pages, transparent or
+// hugetlbfs, as reported by the kernel in /proc/self/smaps
+size_t memHugeBackedBytes()
+{
+    char line[512];
+    unsigned long start, end, kb;
+    bool ours = false;
+    size_t bytes = 0;
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            ours = ownsHostRange(start, end);
+        else if (ours && (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+                          sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+                          sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1))
+            bytes += (size_t)kb * 1024;
+    }
+    fclose(f);
+    return bytes;
+}
+
+// Records end-of-run figures; must run before guest memory is freed
+void memMeasure()
+{
+    MEM_RESIDENT_BYTES = memResidentBytes();
+    MEM_HOST_BYTES = (MEM_BASE != NULL) ? MEM_RESIDENT_BYTES : slabFootprint(&PAGE_SLAB);
+    MEM_HUGE_BYTES = memHugeBackedBytes();
+}
+
+void printMemSummary()
+{
+    printf("\n ----- Memory Summary ----- \n");
+    printf("Guest pages resident: %zu KB\n", MEM_RESIDENT_BYTES / 1024);
+    printf("Host RAM for guest:   %zu KB\n", MEM_HOST_BYTES / 1024);
+    printf("Huge page backed:     %zu KB (%.1f%%)\n", MEM_HUGE_BYTES / 1024,
+           MEM_HOST_BYTES ? 100.0 * MEM_HUGE_BYTES / MEM_HOST_BYTES : 0.0);
+}
@@ -0,0 +1,178 @@
+#ifndef GUEST_MEMORY_H_
+#define GUEST_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Guest memory is kept in 4 KB pages reached through a two-level
+ * radix table: the top 10 bits of an address select a second-level
+ * table, the next 10 bits select the page and the low 12 bits are
+ * the offset inside the page. Pages are only allocated on the first
+ * write; until then reads are served from the shared ZERO_PAGE, so
+ * BSS, stack and any other untouched memory cost no host memory.
+ */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1u << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+#define L2_BITS 10
+#define L2_SIZE (1u << L2_BITS)
+#define L1_BITS (32 - PAGE_BITS - L2_BITS)
+#define L1_SIZE (1u << L1_BITS)
+
+#define PAGE_NUMBER(ADDR) ((uint32_t)(ADDR) >> PAGE_BITS)
+#define L1_INDEX(ADDR) ((uint32_t)(ADDR) >> (PAGE_BITS + L2_BITS))
+#define L2_INDEX(ADDR) (((uint32_t)(ADDR) >> PAGE_BITS) & (L2_SIZE - 1))
+
+/*
+ * Pages and second-level tables are reference counted so snapshots can
+ * share them with the live guest. Anything with refs > 1 is read-only
+ * and is copied on the first write (see memPageAlloc).
+ */
+typedef struct guestPage
+{
+    uint8_t data[PAGE_SIZE];
+    uint32_t refs;
+} guestPage;
+
+typedef struct pageTable
+{
+    uint32_t refs;
+    guestPage *pages[L2_SIZE];
+} pageTable;
+
+/*
+ * One dirty bit per guest page, set on the store path. In the paged
+ * backend the bit is set when a page enters the write TLB, so clearing
+ * the bits must also flush TLB_WRITE (memClearDirty does both).
+ * MEM_DIRTY_ALL is raised when the whole address space changed at once
+ * (snapshot restore) and the next checkpoint has to be a full one.
+ */
+#define PAGE_COUNT (1u << (32 - PAGE_BITS))
+#define DIRTY_WORDS (PAGE_COUNT / 32)
+#define MARK_DIRTY(ADDR) (MEM_DIRTY[PAGE_NUMBER(ADDR) >> 5] |= 1u << (PAGE_NUMBER(ADDR) & 31))
+#define IS_DIRTY(PAGE) ((MEM_DIRTY[(PAGE) >> 5] >> ((PAGE) & 31)) & 1)
+
+/*
+ * One code bit per guest page, set by memMarkCode once something has
+ * cached a decoded form of the page. The first store to a code page
+ * clears the bit and calls MEM_CODE_WRITE before the store lands, so
+ * the cache can drop its copy. In the paged backend code pages are
+ * kept out of TLB_WRITE so that first store always takes the slow path.
+ */
+#define IS_CODE(PAGE) ((MEM_CODE[(PAGE) >> 5] >> ((PAGE) & 31)) & 1)
+
+typedef void (*codeWriteHook)(uint32_t ADDR);
+
+/*
+ * Named guest address ranges (loaded segments, BSS, stack, ...). They
+ * do not change how memory behaves, every unwritten byte reads as 0,
+ * but they let the loader record what it set up.
+ */
+#define MAX_REGIONS 32
+
+typedef struct memRegion
+{
+    uint32_t start;
+    uint32_t end;
+    const char *name;
+} memRegion;
+
+typedef void (*pageVisitor)(uint32_t ADDR, const uint8_t *data, void *ctx);
+
+typedef struct memSnapshot
+{
+    pageTable *tables[L1_SIZE];
+} memSnapshot;
+
+/*
+ * Backends selectable at startup. The paged backend is the default;
+ * the flat backend reserves the whole 4 GB guest address space as one
+ * MAP_NORESERVE host mapping so translation is just MEM_BASE + addr.
+ * Untouched flat memory is backed by the kernel zero page, so reads of
+ * memory that was never written still return 0.
+ */
+#define MEM_BACKEND_PAGED 0
+#define MEM_BACKEND_FLAT 1
+#define FLAT_MAP_SIZE (((size_t)1 << 32) + PAGE_SIZE)
+
+/*
+ * Direct-mapped software TLBs caching guest page -> host page
+ * translations. Reads, writes and instruction fetches each have their
+ * own table so a data access never evicts the fetch translation of
+ * the loop it runs in. An entry is valid when its tag equals the
+ * guest page number; TLB_INVALID never matches a real page.
+ */
+#define TLB_BITS 8
+#define TLB_SIZE (1u << TLB_BITS)
+#define TLB_INDEX(ADDR) (PAGE_NUMBER(ADDR) & (TLB_SIZE - 1))
+#define TLB_INVALID 0xFFFFFFFF
+
+typedef struct tlbEntry
+{
+    uint32_t tag;
+    uint8_t *page;
+} tlbEntry;
+
+extern pageTable *PAGE_TABLE[L1_SIZE];
+extern uint32_t PAGES_RESIDENT;
+extern tlbEntry TLB_READ[TLB_SIZE];
+extern tlbEntry TLB_WRITE[TLB_SIZE];
+extern tlbEntry TLB_FETCH[TLB_SIZE];
+extern uint8_t ZERO_PAGE[PAGE_SIZE];
+extern memRegion MEM_REGIONS[MAX_REGIONS];
+extern int MEM_REGION_COUNT;
+extern int MEM_BACKEND;
+extern uint8_t *MEM_BASE;
+extern uint32_t MEM_DIRTY[DIRTY_WORDS];
+extern bool MEM_DIRTY_ALL;
+extern uint32_t MEM_CODE[DIRTY_WORDS];
+extern codeWriteHook MEM_CODE_WRITE;
+extern bool MEM_HUGEPAGES;
+extern size_t MEM_RESIDENT_BYTES;
+extern size_t MEM_HOST_BYTES;
+extern size_t MEM_HUGE_BYTES;
+
+extern void initMemory();
+extern void freeMemory();
+extern uint8_t *memPageLookup(uint32_t ADDR);
+extern uint8_t *memPageAlloc(uint32_t ADDR);
+extern void memDiscard(uint32_t ADDR, uint32_t len);
+extern void memMapRegion(uint32_t start, uint32_t size, const char *name);
+extern void tlbFlush();
+extern void tlbFlushPage(uint32_t ADDR);
+
+extern memSnapshot *memTakeSnapshot();
+extern void memRestoreSnapshot(const memSnapshot *snap);
+extern void memFreeSnapshot(memSnapshot *snap);
+
+extern void memClearDirty();
+extern void memMarkCode(uint32_t ADDR);
+extern void memForEachPage(bool dirtyOnly, pageVisitor visit, void *ctx);
+
+extern size_t memResidentBytes();
+extern size_t memMetadataBytes();
+extern size_t memFrameOverheadBytes();
+extern size_t memHugeBackedBytes();
+extern void memMeasure();
+extern void printMemSummary();
+
+// Build with -DMEM_TRACE to print every data access
+extern void writeByte(uint32_t ADDR, uint8_t DATA);
+extern void writeWord(uint32_t ADDR, uint32_t DATA);
+extern uint8_t readByte(uint32_t ADDR);
+extern void writeHalf(uint32_t ADDR, uint16_t DATA);
+extern uint16_t readHalf(uint32_t ADDR);
+extern uint32_t readWord(uint32_t ADDR);
+extern uint32_t fetchWord(uint32_t ADDR);
+
+extern void guest_memcpy_in(uint32_t dst, const void *src, uint32_t len);
+extern void guest_memcpy_out(void *dst, uint32_t src, uint32_t len);
+extern void guest_memmove(uint32_t dst, uint32_t src, uint32_t len);
+extern void guest_memset(uint32_t dst, uint8_t value, uint32_t len);
+extern uint32_t guest_strnlen(uint32_t src, uint32_t max);
+extern uint32_t guest_read_cstr(uint32_t src, char *dst, uint32_t size);
+
+#endif
@@ -1,148 +1,706 @@
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 #include "heap.h"
+#include "arena.h"
 #include "../elf_reader/elf_reader.h"
+#include "../RegFile.h"
+#include "../Log.h"
 
-struct heap_stat *HEAPSTATUS;
+uint64_t *HEAP_MAP;
+uint32_t HEAP_MAP_WORDS;
 
-uint32_t HEAP_END;
+struct heap_block *HEAP_BLOCKS;
+struct heap_block *HEAP_FREE[HEAP_CLASSES];
+struct heap_block *HEAP_LAST;
+uint32_t HEAP_FREE_MAP;
+heap_stats HEAP_STATS;
+
+#define TRACE_BUFFER 1024
+FILE *HEAP_TRACE;
+const uint32_t *HEAP_TRACE_CLOCK;
+static heap_trace_rec TRACE_BUF[TRACE_BUFFER];
+static uint32_t TRACE_LEN;
+static int TRACE_PAUSED;
+
+int HEAP_MODE = HEAP_MODE_SEGREGATED;
+uint32_t HEAP_TOP;
 uint32_t BLOCKNUM;
 uint32_t current_break;
 
+// heap_block nodes are recycled through a slab instead of malloc/free
+slab BLOCK_SLAB;
+
 void initHeap(){
-    HEAPSTATUS = NULL;
-    HEAP_END=0;
+    HEAP_MAP = NULL;
+    HEAP_MAP_WORDS = 0;
+    HEAP_BLOCKS = NULL;
+    HEAP_LAST = NULL;
+    HEAP_FREE_MAP = 0;
+    memset(HEAP_FREE, 0, sizeof(HEAP_FREE));
+    memset(&HEAP_STATS, 0, sizeof(HEAP_STATS));
+    slabInit(&BLOCK_SLAB, sizeof(struct heap_block), 1024);
+    HEAP_TOP=0;
     BLOCKNUM=1;
     current_break = 0;
 }
 
-void addHeapStatus(uint32_t ADDR, int STAT,bool DEBUG) {
+// Bit of ADDR in HEAP_MAP, one bit per HEAP_ALIGN bytes from exec.HEAPSTART
+#define HEAP_MAP_BIT(ADDR) (((uint32_t)(ADDR) - (uint32_t)exec.HEAPSTART) / HEAP_ALIGN)
 
-    struct heap_stat *m;
+// Grow HEAP_MAP so it covers the heap up to top
+static void heapMapReserve(uint32_t top){
+    uint32_t words = (HEAP_MAP_BIT(top) + 63) / 64;
+    if(words <= HEAP_MAP_WORDS) return;
+    uint32_t size = HEAP_MAP_WORDS ? HEAP_MAP_WORDS : 64;
+    while(size < words) size *= 2;
+    uint64_t *map = realloc(HEAP_MAP, size * sizeof(uint64_t));
+    if(map == NULL) {
+        fprintf(stderr, "ERROR: Out of host memory for emulator bookkeeping!\n");
+        exit(-1);
+    }
+    HEAP_MAP = map;
+    memset(HEAP_MAP + HEAP_MAP_WORDS, 0, (size - HEAP_MAP_WORDS) * sizeof(uint64_t));
+    HEAP_MAP_WORDS = size;
+}
 
-    HASH_FIND_INT(HEAPSTATUS,&ADDR ,m);
-    if(m==NULL) {
-        m = (struct heap_stat*)malloc(sizeof(struct heap_stat));    
-        m->addr = ADDR;
-        m->status = STAT;
-        if(DEBUG) printf("hWRITE : Address = %x STAT = %x \n",ADDR,STAT);
-        HASH_ADD_INT(HEAPSTATUS,addr,m);
-    } else {
-        struct heap_stat *dump;
-        m = (struct heap_stat*)malloc(sizeof(struct heap_stat));
-        m->addr = ADDR;
-        m->status = STAT;
-        if(DEBUG) printf("hWRITE : Address = %x STAT = %x \n",ADDR,STAT);
-        HASH_REPLACE_INT(HEAPSTATUS,addr,m,dump);
-        free(dump);
+// Set or clear the allocation bits of [addr, addr+size), a word at a time
+static void heapMapRange(uint32_t addr, uint32_t size, bool allocated){
+    uint32_t bit = HEAP_MAP_BIT(addr);
+    uint32_t end = bit + size / HEAP_ALIGN;
+    while(bit < end) {
+        uint32_t off = bit & 63;
+        uint32_t n = end - bit < 64 - off ? end - bit : 64 - off;
+        uint64_t mask = (n == 64 ? ~0ull : (1ull << n) - 1) << off;
+        if(allocated) HEAP_MAP[bit / 64] |= mask;
+        else          HEAP_MAP[bit / 64] &= ~mask;
+        bit += n;
     }
+}
+
+// True if ADDR lies inside a block handed out by mm_malloc
+bool heapAllocated(uint32_t ADDR){
+    if(HEAP_TOP == 0 || ADDR < (uint32_t)exec.HEAPSTART || ADDR >= HEAP_TOP) return false;
+    uint32_t bit = HEAP_MAP_BIT(ADDR);
+    return (HEAP_MAP[bit / 64] >> (bit & 63)) & 1;
+}
+
+
+// Host bytes spent on heap bookkeeping
+size_t heapMetadataBytes(){
+    return HEAP_MAP_WORDS * sizeof(uint64_t) +
+           slabFootprint(&BLOCK_SLAB) + HASH_OVERHEAD(hh, HEAP_BLOCKS);
+}
 
+// Releases all heap bookkeeping, including that of saved heap states
+void heapCleanUp(){
+    HASH_CLEAR(hh, HEAP_BLOCKS);
+    slabRelease(&BLOCK_SLAB);
+    free(HEAP_MAP);
+    HEAP_MAP = NULL;
+    HEAP_MAP_WORDS = 0;
+    memset(HEAP_FREE, 0, sizeof(HEAP_FREE));
+    HEAP_FREE_MAP = 0;
+    HEAP_LAST = NULL;
 }
 
-int readHeapStatus(uint32_t ADDR,bool DEBUG) {
 
-    struct heap_stat *m;
-    int temp = 0;
-    HASH_FIND_INT(HEAPSTATUS,&ADDR ,m);
-    if(m == NULL) { temp = 0;}
-    else          { temp = m->status;}
-    if(DEBUG) printf("hREAD : Address = %x STAT = %x \n",ADDR,temp);
-    return temp;
+static int compareBlocks(const void *a, const void *b){
+    uint32_t x = (*(struct heap_block * const *)a)->addr;
+    uint32_t y = (*(struct heap_block * const *)b)->addr;
+    return x < y ? -1 : x > y;
+}
 
+// All heap blocks in address order; the caller frees the array
+struct heap_block **heapSortedBlocks(uint32_t *count){
+    struct heap_block **blocks = malloc(sizeof(struct heap_block *) * (HASH_COUNT(HEAP_BLOCKS) + 1));
+    struct heap_block *b, *tmp;
+    uint32_t n = 0;
+    HASH_ITER(hh, HEAP_BLOCKS, b, tmp) {
+        blocks[n++] = b;
+    }
+    qsort(blocks, n, sizeof(struct heap_block *), compareBlocks);
+    *count = n;
+    return blocks;
 }
 
+// External fragmentation: the share of free heap bytes outside the largest free block
+double heapFragmentation(uint64_t *freeBytes, uint32_t *largestFree){
+    struct heap_block *b;
+    uint64_t total = 0;
+    uint32_t largest = 0;
+    int k;
+    for(k=0; k<HEAP_CLASSES; k++) {
+        for(b = HEAP_FREE[k]; b != NULL; b = b->nextFree) {
+            total += b->size;
+            if(b->size > largest) largest = b->size;
+        }
+    }
+    if(freeBytes) *freeBytes = total;
+    if(largestFree) *largestFree = largest;
+    return total ? 1.0 - (double)largest / total : 0.0;
+}
 
 void heapDump(){
-	int heapStart =  exec.HEAPSTART;
-        uint32_t i;
-	printf("-----Heap Dump------");
-	printf("  Heap Start: %d \n",heapStart);
-	printf("  Heap Size: %d \n",HEAP_END-heapStart);
-	for( i=heapStart; i<=HEAP_END; i++) {
-		printf(" %x ",readWord(i,false));
-		if(i%2!=0){
-			printf("\n");
-		}
-		else{
-			printf("\t");
+	struct heap_block **blocks;
+	uint32_t count, i;
+	blocks = heapSortedBlocks(&count);
+	printf("-----Heap Dump------\n");
+	printf("  Heap Start: %x \n",exec.HEAPSTART);
+	printf("  Heap Size: %d \n",HEAP_TOP ? HEAP_TOP-exec.HEAPSTART : 0);
+	for(i=0; i<count; i++) {
+		if(blocks[i]->free)
+			printf("  %08x %10u free\n",blocks[i]->addr,blocks[i]->size);
+		else
+			printf("  %08x %10u used request=%u pc=%08x\n",blocks[i]->addr,blocks[i]->size,blocks[i]->request,blocks[i]->pc);
+	}
+	free(blocks);
+}
+
+// Allocation trace, buffered so recording stays off the hot path
+int heapTraceOpen(const char *path){
+    heap_trace_header header = {HEAP_TRACE_MAGIC, HEAP_TRACE_VERSION,
+        exec.HEAPSTART, exec.BREAKSTART, exec.GSP};
+    HEAP_TRACE = fopen(path, "wb");
+    if(HEAP_TRACE == NULL || fwrite(&header, sizeof(header), 1, HEAP_TRACE) != 1) {
+        fprintf(stderr, "ERROR: Unable to write heap trace %s!\n", path);
+        if(HEAP_TRACE) fclose(HEAP_TRACE);
+        HEAP_TRACE = NULL;
+        return -1;
+    }
+    TRACE_LEN = 0;
+    return 0;
+}
+
+static void traceFlush(){
+    if(TRACE_LEN > 0 && fwrite(TRACE_BUF, sizeof(heap_trace_rec), TRACE_LEN, HEAP_TRACE) != TRACE_LEN)
+        fprintf(stderr, "ERROR: Unable to write heap trace!\n");
+    TRACE_LEN = 0;
+}
+
+static void traceRecord(uint32_t op, uint32_t size, uint32_t addr, uint32_t result){
+    if(HEAP_TRACE == NULL || TRACE_PAUSED) return;
+    TRACE_BUF[TRACE_LEN++] = (heap_trace_rec){op, size, addr, result, HEAP_TRACE_CLOCK ? *HEAP_TRACE_CLOCK : 0};
+    if(TRACE_LEN == TRACE_BUFFER) traceFlush();
+}
+
+void heapTraceClose(){
+    if(HEAP_TRACE == NULL) return;
+    traceFlush();
+    fclose(HEAP_TRACE);
+    HEAP_TRACE = NULL;
+}
+
+// Size class of a block, see heap.h
+static uint32_t sizeClass(uint32_t size){
+    return 31 - __builtin_clz(size / HEAP_ALIGN);
+}
+
+static void pushFree(struct heap_block *b){
+    uint32_t k = sizeClass(b->size);
+    b->free = true;
+    b->prevFree = NULL;
+    b->nextFree = HEAP_FREE[k];
+    if(b->nextFree) b->nextFree->prevFree = b;
+    HEAP_FREE[k] = b;
+    HEAP_FREE_MAP |= 1u << k;
+}
+
+static void unlinkFree(struct heap_block *b){
+    uint32_t k = sizeClass(b->size);
+    if(b->prevFree) b->prevFree->nextFree = b->nextFree;
+    else HEAP_FREE[k] = b->nextFree;
+    if(b->nextFree) b->nextFree->prevFree = b->prevFree;
+    if(HEAP_FREE[k] == NULL) HEAP_FREE_MAP &= ~(1u << k);
+    b->free = false;
+}
+
+static struct heap_block *newBlock(uint32_t addr, uint32_t size){
+    struct heap_block *b = (struct heap_block*)slabAlloc(&BLOCK_SLAB);
+    b->addr = addr;
+    b->size = size;
+    HASH_ADD_INT(HEAP_BLOCKS,addr,b);
+    return b;
+}
+
+// Folds c into a, its physical predecessor. Neither may be on a free list.
+static struct heap_block *mergeBlocks(struct heap_block *a, struct heap_block *c){
+    a->size += c->size;
+    a->next = c->next;
+    if(c->next) c->next->prev = a;
+    else HEAP_LAST = a;
+    HASH_DEL(HEAP_BLOCKS, c);
+    slabFree(&BLOCK_SLAB, c);
+    return a;
+}
+
+// A free block of at least size bytes, or NULL if the heap has to grow
+static struct heap_block *findFree(uint32_t size){
+    uint32_t k = sizeClass(size);
+    struct heap_block *b = HEAP_FREE[k];
+    if(b != NULL && b->size >= size) return b;
+    uint32_t above = k + 1 < HEAP_CLASSES ? HEAP_FREE_MAP & ~((2u << k) - 1) : 0;
+    if(above != 0) return HEAP_FREE[__builtin_ctz(above)];
+    return NULL;
+}
+
+// The heap may grow up to the bottom of the guest stack
+static uint32_t heapLimit(){
+    return (exec.GSP & ~PAGE_MASK) + PAGE_SIZE - STACK_SIZE;
+}
+
+// Carves size bytes off the top of the heap, reusing a free block at the top
+static struct heap_block *growHeap(uint32_t size){
+    uint32_t limit = heapLimit();
+    struct heap_block *b = HEAP_LAST;
+    uint32_t need = size;
+    if(b != NULL && b->free) {
+        if(b->size >= size) {
+            unlinkFree(b);
+            return b;
+        }
+        need -= b->size;
+    }
+    if((uint64_t)HEAP_TOP + need > limit) return NULL;
+    heapMapReserve(HEAP_TOP + need);
+    if(b != NULL && b->free) {
+        unlinkFree(b);
+        b->size = size;
+    } else {
+        b = newBlock(HEAP_TOP, size);
+        b->prev = HEAP_LAST;
+        b->next = NULL;
+        if(HEAP_LAST) HEAP_LAST->next = b;
+        HEAP_LAST = b;
+    }
+    HEAP_TOP += need;
+    return b;
+}
+
+// Returns the tail of b beyond size to the free lists when it is worth a block
+static void splitBlock(struct heap_block *b, uint32_t size){
+	if(b->size - size < HEAP_MIN_SPLIT) return;
+	struct heap_block *rest = newBlock(b->addr + size, b->size - size);
+	rest->prev = b;
+	rest->next = b->next;
+	if(b->next) b->next->prev = rest;
+	else HEAP_LAST = rest;
+	b->next = rest;
+	b->size = size;
+	if(rest->next && rest->next->free) {
+		unlinkFree(rest->next);
+		mergeBlocks(rest, rest->next);
+	}
+	pushFree(rest);
+}
+
+static struct heap_block *segMalloc(uint32_t size){
+	struct heap_block *b;
+	size = (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+	b = findFree(size);
+	if(b != NULL) {
+		unlinkFree(b);
+	} else if((b = growHeap(size)) == NULL) {
+		// the heads were too small and the heap is full, try the rest of the class
+		for(b = HEAP_FREE[sizeClass(size)]; b != NULL && b->size < size; b = b->nextFree);
+		if(b == NULL) return NULL;
+		unlinkFree(b);
+	}
+	splitBlock(b, size);
+	return b;
+}
+
+// Resizes allocated block b in place, taking from a free neighbour or
+// the heap top when growing; returns false if it has to move
+static bool segResize(struct heap_block *b, uint32_t size){
+	struct heap_block *next = b->next;
+	size = (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+	if(size > b->size) {
+		uint32_t need = size - b->size;
+		if(next != NULL && next->free && next->size >= need) {
+			unlinkFree(next);
+			mergeBlocks(b, next);
+		} else if(next == NULL || (next->free && next->next == NULL)) {
+			uint32_t extra = need - (next ? next->size : 0);
+			if((uint64_t)HEAP_TOP + extra > heapLimit()) return false;
+			if(next) {
+				unlinkFree(next);
+				mergeBlocks(b, next);
+			}
+			heapMapReserve(HEAP_TOP + extra);
+			HEAP_TOP += extra;
+			b->size += extra;
+		} else {
+			return false;
 		}
 	}
+	splitBlock(b, size);
+	return true;
 }
 
-// prep heap blocck
+static void segFree(struct heap_block *b){
+	if(b->next && b->next->free) {
+		unlinkFree(b->next);
+		mergeBlocks(b, b->next);
+	}
+	if(b->prev && b->prev->free) {
+		unlinkFree(b->prev);
+		b = mergeBlocks(b->prev, b);
+	}
+	pushFree(b);
+}
 
 
-void prepHeapBlock(uint32_t addr, uint32_t size){
-     uint32_t i;
-	for(i=addr; i<addr+size; i++){
-	    addHeapStatus(i,BLOCKNUM,false);		
+/*
+ * Buddy mode carves blocks out of a single power-of-two arena at
+ * exec.HEAPSTART. Block sizes are powers of two, so a block of size
+ * HEAP_ALIGN << k sits exactly on HEAP_FREE[k] and the segregated
+ * lists double as the per-order free lists. Splitting on malloc and
+ * merging on free each take at most one step per order.
+ */
+static uint32_t buddyArenaSize(){
+	uint32_t size = 1u << BUDDY_MAX_ORDER;
+	while(size > heapLimit() - (uint32_t)exec.HEAPSTART) size >>= 1;
+	return size;
+}
+
+static struct heap_block *buddyMalloc(uint32_t size){
+	uint32_t arena = buddyArenaSize();
+	uint32_t bsize = BUDDY_MIN_BLOCK;
+	struct heap_block *b;
+	while(bsize < size) {
+		if(bsize >= arena) return NULL;
+		bsize <<= 1;
 	}
+	uint32_t avail = HEAP_FREE_MAP & ~((1u << sizeClass(bsize)) - 1);
+	if(avail == 0) return NULL;
+	b = HEAP_FREE[__builtin_ctz(avail)];
+	unlinkFree(b);
+	while(b->size > bsize) {
+		b->size >>= 1;
+		pushFree(newBlock(b->addr + b->size, b->size));
+	}
+	if(b->addr + b->size > HEAP_TOP) {
+		heapMapReserve(b->addr + b->size);
+		HEAP_TOP = b->addr + b->size;
+	}
+	return b;
 }
 
+// A buddy block can only be resized in place within its own size; the
+// upper halves it no longer needs go back on the free lists
+static bool buddyResize(struct heap_block *b, uint32_t size){
+	if(size > b->size) return false;
+	while(b->size / 2 >= size && b->size / 2 >= BUDDY_MIN_BLOCK) {
+		b->size >>= 1;
+		pushFree(newBlock(b->addr + b->size, b->size));
+	}
+	return true;
+}
+
+static void buddyFree(struct heap_block *b){
+	uint32_t arena = buddyArenaSize();
+	struct heap_block *buddy;
+	while(b->size < arena) {
+		uint32_t addr = ((b->addr - (uint32_t)exec.HEAPSTART) ^ b->size) + (uint32_t)exec.HEAPSTART;
+		HASH_FIND_INT(HEAP_BLOCKS,&addr,buddy);
+		if(buddy == NULL || !buddy->free || buddy->size != b->size) break;
+		unlinkFree(buddy);
+		if(buddy->addr < b->addr) {
+			struct heap_block *t = b;
+			b = buddy;
+			buddy = t;
+		}
+		b->size <<= 1;
+		HASH_DEL(HEAP_BLOCKS, buddy);
+		slabFree(&BLOCK_SLAB, buddy);
+	}
+	pushFree(b);
+}
 
 
 uint32_t mm_malloc(uint32_t size){
-	if(size==0){return 0;}
-	uint32_t heapStart =  exec.HEAPSTART;
-        uint32_t i;
-	if(HEAP_END==0){HEAP_END=heapStart;}
+	if(size==0 || size > UINT32_MAX - HEAP_ALIGN){return 0;}
+	struct heap_block *b;
+	if(HEAP_TOP==0){
+		HEAP_TOP=exec.HEAPSTART;
+		if(HEAP_MODE == HEAP_MODE_BUDDY) pushFree(newBlock(exec.HEAPSTART, buddyArenaSize()));
+	}
 	BLOCKNUM++;
-	int blockCounter=0;
-	for(i=heapStart; i<=HEAP_END+size; i++) {
-		
-		if (readHeapStatus(i,false)==0) {blockCounter++;}
-		else {blockCounter=0;}
-	       // printf("blockCounter = %d \n ",blockCounter);
-		uint32_t blockStart = i-size+1;
-		if (blockCounter>=size && (blockStart%4==0)) {
-                        printf("DEBUG : Found Heap Block @ %x\n",blockStart);
-		 	prepHeapBlock(blockStart,size);
-			if(i>HEAP_END){HEAP_END=i;}
-			//memLog("Malloc returned " + num2Str(blockStart));
-			return blockStart;
-		}
+	b = HEAP_MODE == HEAP_MODE_BUDDY ? buddyMalloc(size) : segMalloc(size);
+	if(b == NULL) {
+		HEAP_STATS.failed++;
+		traceRecord(HEAP_TRACE_MALLOC, size, 0, 0);
+		return 0;
 	}
-	return 0;
+	LOG(LOG_INSTRUCTION, "DEBUG : Found Heap Block @ %x\n",b->addr);
+	// every allocation arrives through a redirected libc call, and jal links
+	// to PC + 4 (there is no delay slot), so $ra - 4 is its call site
+	b->request = size;
+	b->pc = RegFile[31] - 4;
+	HEAP_STATS.allocs++;
+	HEAP_STATS.histogram[31 - __builtin_clz(size)]++;
+	HEAP_STATS.liveBlocks++;
+	HEAP_STATS.liveBytes += size;
+	if(HEAP_STATS.liveBytes > HEAP_STATS.peakBytes) HEAP_STATS.peakBytes = HEAP_STATS.liveBytes;
+	traceRecord(HEAP_TRACE_MALLOC, size, 0, b->addr);
+	heapMapRange(b->addr,b->size,true);
+	return b->addr;
 }
 
 
 
 void mm_free(uint32_t addr){
-	//int heapStart =  exec.HEAPSTART;
-	int num = readHeapStatus(addr,false);
-        uint32_t i;
-	//memLog("Freeing " + num2Str(addr));
+	struct heap_block *b;
 	if(addr == 0) {
 		return;
 	}
-	if(num==0){
-		//fprintf(stderr,"Freeing unallocated memory at %8x!!!\n",addr);
-		printf("Freeing unallocated memory at %8x!!!\n",addr);
+	HASH_FIND_INT(HEAP_BLOCKS,&addr,b);
+	if(b == NULL || b->free){
+		fprintf(stderr, "ERROR: Freeing unallocated memory at %8x!!!\n",addr);
+		exit(-1);
+	}
+	traceRecord(HEAP_TRACE_FREE, b->request, addr, 0);
+	HEAP_STATS.frees++;
+	HEAP_STATS.liveBlocks--;
+	HEAP_STATS.liveBytes -= b->request;
+	heapMapRange(b->addr,b->size,false);
+	if(HEAP_MODE == HEAP_MODE_BUDDY) buddyFree(b);
+	else segFree(b);
+	// No TLB flush: freeing a block keeps its pages mapped, and pages
+	// that do go away are flushed one by one in memDiscard
+}
+
+
+// realloc(3): resize in place when the allocator can, otherwise move
+// the contents to a new block with a host-side copy
+uint32_t mm_realloc(uint32_t addr, uint32_t size){
+	struct heap_block *b;
+	uint32_t to;
+	// rounding a larger size up to HEAP_ALIGN would wrap to 0
+	if(size > UINT32_MAX - HEAP_ALIGN) {
+		HEAP_STATS.failed++;
+		traceRecord(HEAP_TRACE_REALLOC, size, addr, 0);
+		return 0;
+	}
+	if(addr == 0) {
+		return mm_malloc(size);
+	}
+	if(size == 0) {
+		mm_free(addr);
+		return 0;
+	}
+	HASH_FIND_INT(HEAP_BLOCKS,&addr,b);
+	if(b == NULL || b->free){
+		fprintf(stderr, "ERROR: Reallocating unallocated memory at %8x!!!\n",addr);
 		exit(-1);
 	}
-	for(i=addr; i<=HEAP_END; i++) {			
-		if (readHeapStatus(i,false)==num)
-			{addHeapStatus(i,0,false);}
-		else break;								
+	uint32_t oldSize = b->size;
+	if(HEAP_MODE == HEAP_MODE_BUDDY ? buddyResize(b, size) : segResize(b, size)) {
+		heapMapRange(b->addr, oldSize, false);
+		heapMapRange(b->addr, b->size, true);
+		HEAP_STATS.liveBytes = HEAP_STATS.liveBytes - b->request + size;
+		if(HEAP_STATS.liveBytes > HEAP_STATS.peakBytes) HEAP_STATS.peakBytes = HEAP_STATS.liveBytes;
+		b->request = size;
+		b->pc = RegFile[31] - 4;
+		traceRecord(HEAP_TRACE_REALLOC, size, addr, addr);
+		return addr;
 	}
+	TRACE_PAUSED++;
+	to = mm_malloc(size);
+	if(to != 0) {
+		guest_memmove(to, addr, oldSize < size ? oldSize : size);
+		mm_free(addr);
+	}
+	TRACE_PAUSED--;
+	traceRecord(HEAP_TRACE_REALLOC, size, addr, to);
+	return to;
+}
+
+// calloc(3): whole pages are handed back so they read from the zero
+// page, only the partial pages at either end are cleared by hand
+uint32_t mm_calloc(uint32_t count, uint32_t size){
+	uint64_t total = (uint64_t)count * size;
+	if(total > UINT32_MAX) {
+		HEAP_STATS.failed++;
+		return 0;
+	}
+	uint32_t addr = mm_malloc(total);
+	if(addr == 0) {
+		return 0;
+	}
+	uint32_t head = ((addr + PAGE_MASK) & ~PAGE_MASK) - addr;
+	uint32_t tail = (addr + total) & PAGE_MASK;
+	if(head > total) head = total;
+	if(tail > total - head) tail = total - head;
+	guest_memset(addr, 0, head);
+	memDiscard(addr, total);
+	guest_memset(addr + total - tail, 0, tail);
+	return addr;
 }
 
 
+/*
+ * The program break lives in [exec.BREAKSTART, exec.HEAPSTART). Growing
+ * it costs nothing up front since untouched pages read from the zero
+ * page; shrinking gives the pages above the new break back so they
+ * read as zero when the break grows over them again, as on Linux.
+ */
+static void setBreak(int64_t newBreak) {
+	if(newBreak < (uint32_t)exec.BREAKSTART || newBreak >= (uint32_t)exec.HEAPSTART) {
+		return;
+	}
+	if(newBreak < current_break) {
+		uint32_t end = (current_break + PAGE_MASK) & ~PAGE_MASK;
+		memDiscard(newBreak, end - newBreak);
+	}
+	current_break = newBreak;
+}
+
 uint32_t mm_sbrk(int32_t value) {
-	if(current_break < exec.BREAKSTART) {
+	if(current_break < (uint32_t)exec.BREAKSTART) {
 		current_break = exec.BREAKSTART;
 	}
-	int64_t temp_break = current_break;
-	temp_break += value;
-	if(temp_break >= exec.BREAKSTART && temp_break < exec.HEAPSTART) {	
-		current_break = temp_break;
+	setBreak((int64_t)current_break + value);
+	traceRecord(HEAP_TRACE_SBRK, value, 0, current_break);
+	return current_break;
+}
+
+// brk(2): move the break to addr and return the resulting break, which
+// is left unchanged when addr is 0 or outside the break region
+uint32_t mm_brk(uint32_t addr) {
+	if(current_break < (uint32_t)exec.BREAKSTART) {
+		current_break = exec.BREAKSTART;
 	}
+	if(addr != 0) {
+		setBreak(addr);
+	}
+	traceRecord(HEAP_TRACE_BRK, addr, 0, current_break);
 	return current_break;
 }
 
 
+/*
+ * Flatten the block list: free blocks first, each size class from the
+ * tail of its list to the head, then the allocated ones. Pushing the
+ * free records back in that order rebuilds the exact list order, so a
+ * restored heap hands out the same addresses the original would have.
+ * Allocated blocks go through the hash since buddy blocks are not
+ * chained in address order.
+ */
+static heap_block_rec *saveBlocks(uint32_t *count) {
+
+    heap_block_rec *recs = malloc(sizeof(heap_block_rec) * (HASH_COUNT(HEAP_BLOCKS) + 1));
+    struct heap_block *b, *tmp;
+    uint32_t n = 0;
+    int k;
+    for(k=0; k<HEAP_CLASSES; k++) {
+        for(b = HEAP_FREE[k]; b != NULL && b->nextFree != NULL; b = b->nextFree);
+        for(; b != NULL; b = b->prevFree) {
+            recs[n++] = (heap_block_rec){b->addr, b->size, 1, 0, 0};
+        }
+    }
+    HASH_ITER(hh, HEAP_BLOCKS, b, tmp) {
+        if(!b->free) recs[n++] = (heap_block_rec){b->addr, b->size, 0, b->request, b->pc};
+    }
+    *count = n;
+    return recs;
+
+}
+
+static void loadBlocks(const heap_block_rec *recs, uint32_t count) {
+
+    struct heap_block *b, *tmp, *prev = NULL;
+    uint32_t addr, i;
+    HASH_ITER(hh, HEAP_BLOCKS, b, tmp) {
+        HASH_DEL(HEAP_BLOCKS, b);
+        slabFree(&BLOCK_SLAB, b);
+    }
+    memset(HEAP_FREE, 0, sizeof(HEAP_FREE));
+    HEAP_FREE_MAP = 0;
+    if(HEAP_MAP) memset(HEAP_MAP, 0, HEAP_MAP_WORDS * sizeof(uint64_t));
+    if(HEAP_TOP != 0) heapMapReserve(HEAP_TOP);
+    HEAP_STATS.liveBytes = HEAP_STATS.liveBlocks = 0;
+    for(i=0; i<count; i++) {
+        b = newBlock(recs[i].addr, recs[i].size);
+        if(recs[i].free) pushFree(b);
+        else {
+            b->free = false;
+            b->request = recs[i].request;
+            b->pc = recs[i].pc;
+            heapMapRange(b->addr, b->size, true);
+            HEAP_STATS.liveBytes += b->request;
+            HEAP_STATS.liveBlocks++;
+        }
+    }
+    // relink the physical chain by walking the heap from its start
+    HEAP_LAST = NULL;
+    for(addr = exec.HEAPSTART; HEAP_MODE == HEAP_MODE_SEGREGATED && count > 0 && addr < HEAP_TOP; addr += b->size) {
+        HASH_FIND_INT(HEAP_BLOCKS,&addr,b);
+        if(b == NULL) break;
+        b->prev = prev;
+        b->next = NULL;
+        if(prev) prev->next = b;
+        prev = HEAP_LAST = b;
+    }
+
+}
+
+void heapSave(struct heap_state *state) {
+
+    state->blocks = saveBlocks(&state->blockCount);
+    state->heapTop = HEAP_TOP;
+    state->blockNum = BLOCKNUM;
+    state->currentBreak = current_break;
 
+}
+
+void heapRestore(const struct heap_state *state) {
+
+    HEAP_TOP = state->heapTop;
+    loadBlocks(state->blocks, state->blockCount);
+    BLOCKNUM = state->blockNum;
+    current_break = state->currentBreak;
+
+}
+
+void heapStateFree(struct heap_state *state) {
 
+    free(state->blocks);
+    state->blocks = NULL;
+
+}
 
 
+// Serialize the allocator bookkeeping for on-disk checkpoints
+int heapWrite(FILE *f) {
 
+    uint32_t count;
+    heap_block_rec *recs = saveBlocks(&count);
+    uint32_t header[5] = {HEAP_MODE, HEAP_TOP, BLOCKNUM, current_break, count};
+    bool ok = fwrite(header,sizeof(header),1,f) == 1;
+    ok = ok && (count == 0 || fwrite(recs,sizeof(heap_block_rec),count,f) == count);
+    free(recs);
+    return ok ? 0 : -1;
+
+}
+
+int heapRead(FILE *f) {
+
+    uint32_t header[5];
+    heap_block_rec *recs;
+    if(fread(header,sizeof(header),1,f) != 1) return -1;
+    HEAP_MODE = header[0];
+    HEAP_TOP = header[1];
+    BLOCKNUM = header[2];
+    current_break = header[3];
+    recs = malloc(sizeof(heap_block_rec) * (header[4] + 1));
+    if(header[4] > 0 && fread(recs,sizeof(heap_block_rec),header[4],f) != header[4]) {
+        free(recs);
+        return -1;
+    }
+    loadBlocks(recs, header[4]);
+    free(recs);
+    return 0;
+
+}
@@ -1,28 +1,155 @@
 #ifndef HEAP_H_
 #define HEAP_H_
 
+#include <stdio.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include "uthash.h"
 
-extern uint32_t HEAP_END;
+extern int HEAP_MODE;
+extern uint32_t HEAP_TOP;
 extern uint32_t BLOCKNUM;
 extern uint32_t current_break;
 
-typedef struct heap_stat {
+/*
+ * HEAP_MAP has one bit per HEAP_ALIGN bytes of guest heap, set while
+ * the bytes belong to an allocated block. It grows with HEAP_TOP.
+ */
+extern uint64_t *HEAP_MAP;
+extern uint32_t HEAP_MAP_WORDS;
+
+/*
+ * mm_malloc/mm_free keep one host-side node per guest heap block. Nodes
+ * are chained in address order so a freed block can be merged with its
+ * neighbours, and free blocks also sit on a list for their size class:
+ * class k holds blocks of [HEAP_ALIGN << k, HEAP_ALIGN << (k+1)) bytes.
+ * Any block from a class above the request's fits it, so malloc only
+ * looks at list heads and HEAP_FREE_MAP finds the next non-empty class.
+ */
+#define HEAP_ALIGN 8
+#define HEAP_CLASSES 32
+#define HEAP_MIN_SPLIT 16
+
+/*
+ * Allocators selectable at startup. The buddy allocator trades
+ * fragmentation for a bounded O(log n) malloc/free; its arena is at
+ * most 2^BUDDY_MAX_ORDER bytes and blocks are at least BUDDY_MIN_BLOCK.
+ */
+#define HEAP_MODE_SEGREGATED 0
+#define HEAP_MODE_BUDDY 1
+#define BUDDY_MAX_ORDER 29
+#define BUDDY_MIN_BLOCK 32
+
+typedef struct heap_block {
 
 	uint32_t addr;
-	int status; 
+	uint32_t size;
+	uint32_t request;	// bytes asked for by the guest
+	uint32_t pc;		// call site of the allocating libc call
+	bool free;
+	struct heap_block *prev, *next;
+	struct heap_block *prevFree, *nextFree;
 	UT_hash_handle hh;
 
-}heap_stat;
+}heap_block;
+
+// Flattened heap_block used by snapshots and checkpoints
+typedef struct heap_block_rec {
+
+	uint32_t addr;
+	uint32_t size;
+	uint32_t free;
+	uint32_t request;
+	uint32_t pc;
+
+}heap_block_rec;
+
+// Allocator activity since startup; histogram[k] counts requests of [2^k, 2^(k+1)) bytes
+typedef struct heap_stats {
+
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t failed;
+	uint64_t liveBytes;
+	uint64_t liveBlocks;
+	uint64_t peakBytes;
+	uint64_t histogram[32];
+
+}heap_stats;
+
+extern heap_stats HEAP_STATS;
+
+/*
+ * -heaptrace records every mm_malloc/mm_free/mm_realloc/mm_sbrk/mm_brk call as a
+ * fixed-size record after a header describing the guest layout, so a
+ * trace can be replayed offline against each allocator (make bench).
+ * HEAP_TRACE_CLOCK points at the emulator's instruction counter.
+ */
+#define HEAP_TRACE_MAGIC 0x54484d45 /* "EMHT" */
+#define HEAP_TRACE_VERSION 2
+#define HEAP_TRACE_MALLOC 0
+#define HEAP_TRACE_FREE 1
+#define HEAP_TRACE_SBRK 2
+#define HEAP_TRACE_BRK 3
+#define HEAP_TRACE_REALLOC 4
+
+typedef struct heap_trace_header {
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t heapStart;
+	uint32_t breakStart;
+	uint32_t stackPointer;
+
+}heap_trace_header;
+
+// size is the request (malloc, realloc), the block's request (free), the increment (sbrk)
+// or the asked-for break (brk); addr is the block passed in and result the value returned
+typedef struct heap_trace_rec {
+
+	uint32_t op;
+	uint32_t size;
+	uint32_t addr;
+	uint32_t result;
+	uint32_t icount;
+
+}heap_trace_rec;
+
+extern const uint32_t *HEAP_TRACE_CLOCK;
+
+extern struct heap_block *HEAP_BLOCKS;
+
+// Allocator state captured by snapshots
+typedef struct heap_state {
+
+	struct heap_block_rec *blocks;
+	uint32_t blockCount;
+	uint32_t heapTop;
+	uint32_t blockNum;
+	uint32_t currentBreak;
 
-extern struct heap_stat *HEAPSTATUS ;
+}heap_state;
 
 
 extern void initHeap();
+extern void heapCleanUp();
+extern size_t heapMetadataBytes();
 extern void heapDump();
+extern struct heap_block **heapSortedBlocks(uint32_t *count);
+extern double heapFragmentation(uint64_t *freeBytes, uint32_t *largestFree);
+extern bool heapAllocated(uint32_t ADDR);
 extern uint32_t mm_malloc(uint32_t size);
 extern void mm_free(uint32_t addr);
+extern uint32_t mm_realloc(uint32_t addr, uint32_t size);
+extern uint32_t mm_calloc(uint32_t count, uint32_t size);
 extern uint32_t mm_sbrk(int32_t value);
+extern uint32_t mm_brk(uint32_t addr);
+extern void heapSave(struct heap_state *state);
+extern void heapRestore(const struct heap_state *state);
+extern void heapStateFree(struct heap_state *state);
+extern int heapTraceOpen(const char *path);
+extern void heapTraceClose();
+extern int heapWrite(FILE *f);
+extern int heapRead(FILE *f);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+.data
+# sixteen live heap blocks, replaced round robin
+slots: .space 64
+.text
+.global __start
+__start:
+# s0 = iteration, s1 = iteration count, s2 = slot table
+	li	$s0,0
+	li	$s1,20000
+	la	$s2,slots
+	li	$s3,37
+LOOP:	beq	$s0,$s1,DONE
+	nop
+# t0 = address of this iteration's slot
+	andi	$t0,$s0,15
+	sll	$t0,$t0,2
+	addu	$t0,$t0,$s2
+# a1 = request size, 8 to 1031 bytes
+	multu	$s0,$s3
+	mflo	$t1
+	andi	$t1,$t1,1023
+	addiu	$a1,$t1,8
+	lw	$a0,0($t0)
+	beq	$a0,$zero,ALLOC
+	nop
+# every fourth iteration resizes the block in place of replacing it
+	andi	$t2,$s0,3
+	bne	$t2,$zero,REPLACE
+	nop
+	li	$v0,4556		#realloc
+	syscall
+	b	STORE
+	nop
+REPLACE:
+	li	$v0,4091		#free
+	syscall
+ALLOC:	xor	$a0,$a1,$zero
+	li	$v0,4555		#malloc
+	syscall
+STORE:	sw	$v0,0($t0)
+	addiu	$s0,$s0,1
+	b	LOOP
+	nop
+# free whatever is still live, then exit
+DONE:	li	$s0,0
+FREE:	sll	$t0,$s0,2
+	addu	$t0,$t0,$s2
+	lw	$a0,0($t0)
+	li	$v0,4091		#free
+	syscall
+	addiu	$s0,$s0,1
+	li	$t1,16
+	bne	$s0,$t1,FREE
+	nop
+	li	$a0,0
+	li	$v0,0XFA1		#exit
+	syscall